@@ -2,16 +2,25 @@
 #include "ECSApp.h"
 #include "QueueCollection.h"
 #include "EntityCreationMessageV2.h"
+#include "EntityMessageDecoder.h"
+#include "BinaryEntityCodec.h"
+#include "JsonDocumentSplitter.h"
+#include "IngestBatch.h"
+#include "FrameCapture.h"
 #include <iostream>
 #include <thread>
 #include <unordered_map>
 #include <cstdlib>
+#include <cstdio>
 #include <ctime>
 #include <vector>
 // Note: For Windows, include Winsock2.h and link against Ws2_32.lib
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
 #include <arpa/inet.h>
 #include <chrono>
 #include <json.hpp>
@@ -29,63 +38,103 @@ struct EntityDefinition
         : x(x), y(y), z(z), type(type) {}
 };
 
-void parseCommandV2(const std::string &command, QueueCollection &queues)
+// Decodes one json entity message and adds it to the batch as a create,
+// update or delete. Returns the entity id, throwing on malformed input
+int submitJsonMessage(const char *data, size_t length, EntityMessageDecoder &decoder, IngestBatch &batch)
 {
-    using json = nlohmann::json;
-
-    json j = json::parse(command);
+    QueueCollection &queues = batch.Queues();
+    auto start = std::chrono::steady_clock::now();
     EntityCreationMessageV2 msg;
-
-    try
+    if (!decoder.Decode(data, length, msg))
     {
-        msg.id = j.at("id").get<int>();
+        throw std::runtime_error(decoder.Error());
     }
-    catch (const json::type_error &e)
+    queues.ingestStats.jsonDecode.Record(length, std::chrono::steady_clock::now() - start);
+
+    int id = msg.id;
+    switch (decoder.Type())
     {
-        std::string idStr = j.at("id").get<std::string>();
-        msg.id = std::stoi(idStr);
+    case EntityMessageType::Create:
+        batch.Add(std::move(msg));
+        break;
+    case EntityMessageType::Update:
+        batch.Add(EntityUpdateMessage::FromPartial(std::move(msg), decoder.HasPositions()));
+        break;
+    case EntityMessageType::Delete:
+        batch.Add(EntityDeletionMessage(id));
+        break;
     }
+    return id;
+}
 
-    msg.shapeType = j.at("shapeType").get<std::string>();
-    msg.transform.position = j["transform"]["position"].get<std::vector<float>>();
-    msg.transform.rotation = j["transform"]["rotation"].get<std::vector<float>>();
-    msg.transform.scale = j["transform"]["scale"].get<std::vector<float>>();
-    msg.shaders.vertexShader = j["shaders"]["vertex"].get<std::string>();
-    msg.shaders.fragmentShader = j["shaders"]["fragment"].get<std::string>();
+// Decodes one binary entity frame and adds it to the batch. Returns the
+// entity id, throwing on malformed input
+int submitBinaryMessage(const char *data, size_t length, IngestBatch &batch)
+{
+    QueueCollection &queues = batch.Queues();
+    auto start = std::chrono::steady_clock::now();
+    BinaryEntityCodec codec(&queues.floatBufferPool);
+    BinaryFrameHeader header;
+    BinaryEntityCodec::ReadHeader(data, length, header);
 
-    // Extracting uniform data
-    for (auto &[key, val] : j["uniforms"].items())
+    int id = 0;
+    size_t positionFloats = 0;
+    bool decoded = false;
+    switch (header.messageType)
     {
-        std::string type = val["type"];
-        std::vector<float> values = val["value"].get<std::vector<float>>();
-
-        if (type == "floatVecUniforms" && values.size() >= 4)
-        {
-            msg.uniforms.floatVecUniforms[key] = values;
-        }
+    case BINARY_UPDATE:
+    {
+        EntityUpdateMessage msg;
+        decoded = codec.DecodeUpdate(data, length, msg);
+        id = msg.id;
+        positionFloats = msg.vertexData.positions.size();
+        if (decoded)
+            batch.Add(std::move(msg));
+        break;
     }
-
-    // Extracting vertex data
-    if (j.find("vertexData") != j.end())
+    case BINARY_DELETE:
+        decoded = codec.DecodeDelete(data, length, id);
+        if (decoded)
+            batch.Add(EntityDeletionMessage(id));
+        break;
+    default:
     {
-        if (j["vertexData"].find("positions") != j["vertexData"].end())
-            msg.vertexData.positions = j["vertexData"]["positions"].get<std::vector<float>>();
-        if (j["vertexData"].find("normals") != j["vertexData"].end())
-            msg.vertexData.normals = j["vertexData"]["normals"].get<std::vector<float>>();
-        if (j["vertexData"].find("texCoords") != j["vertexData"].end())
-            msg.vertexData.texCoords = j["vertexData"]["texCoords"].get<std::vector<float>>();
-        if (j["vertexData"].find("colors") != j["vertexData"].end())
-            msg.vertexData.colors = j["vertexData"]["colors"].get<std::vector<float>>();
+        EntityCreationMessageV2 msg;
+        decoded = codec.Decode(data, length, msg);
+        id = msg.id;
+        positionFloats = msg.vertexData.positions.size();
+        if (decoded)
+            batch.Add(std::move(msg));
+        break;
+    }
     }
+    if (!decoded)
+    {
+        throw std::runtime_error(codec.Error());
+    }
+    queues.ingestStats.binaryDecode.Record(length, std::chrono::steady_clock::now() - start);
+    queues.ingestStats.RecordCopy(positionFloats * sizeof(float));
+    return id;
+}
 
-    // Pushing the parsed message into the creation queue
-    std::vector<EntityCreationMessageV2> creationMessages{msg};
-    queues.entityCreationV2Queue.Push(creationMessages);
+void parseCommandV2(const std::string &command, QueueCollection &queues)
+{
+    EntityMessageDecoder decoder(&queues.floatBufferPool);
+
+    // Pushing the parsed message onto its queue, moved rather than copied
+    IngestBatch batch(queues);
+    submitJsonMessage(command.data(), command.size(), decoder, batch);
+    batch.Flush();
+}
 
-    // Additional commands like DELETE or COLOR can be similarly handled
+void parseBinaryCommand(const char *data, size_t length, QueueCollection &queues)
+{
+    IngestBatch batch(queues);
+    submitBinaryMessage(data, length, batch);
+    batch.Flush();
 }
 
-void parseCommand(const std::string &command, QueueCollection &queues)
+void parseCommand(const std::string &command, IngestBatch &batch)
 {
     std::istringstream iss(command);
     std::string cmd;
@@ -99,8 +148,7 @@ void parseCommand(const std::string &command, QueueCollection &queues)
         int id;
         iss >> id >> type >> x >> y >> z;
         // Add to entity creation queue in your system
-        std::vector<EntityCreationMessage> creationMessages{EntityCreationMessage(id, type, x, y, z)};
-        queues.entityCreationQueue.Push(creationMessages);
+        batch.Add(EntityCreationMessage(id, type, x, y, z));
     }
     else if (cmd == "DELETE")
     {
@@ -108,8 +156,7 @@ void parseCommand(const std::string &command, QueueCollection &queues)
         int id;
         iss >> id;
         // Add to entity deletion queue in your system
-        std::vector<EntityDeletionMessage> deletionMessages{EntityDeletionMessage(id)};
-        queues.entityDeletionQueue.Push(deletionMessages);
+        batch.Add(EntityDeletionMessage(id));
     }
     else if (cmd == "COLOR")
     {
@@ -117,29 +164,75 @@ void parseCommand(const std::string &command, QueueCollection &queues)
         float r, g, b;
         iss >> r >> g >> b;
         // Add to color change queue or set color directly
-        queues.colorQueue.Push(std::make_tuple(r, g, b));
+        batch.AddColor(r, g, b);
     }
     else
     {
-        std::cout << "command: " << command << std::endl;
-        parseCommandV2(command, queues);
+        EntityMessageDecoder decoder(&batch.Queues().floatBufferPool);
+        submitJsonMessage(command.data(), command.size(), decoder, batch);
     }
 }
 
+// Reads the whole request body; mg_read may return less than requested
+bool readRequestBody(struct mg_connection *conn, std::string &body, size_t length)
+{
+    body.resize(length);
+    size_t received = 0;
+    while (received < length)
+    {
+        int bytes = mg_read(conn, &body[received], length - received);
+        if (bytes <= 0)
+        {
+            return false;
+        }
+        received += bytes;
+    }
+    return true;
+}
+
+bool isBinaryContentType(struct mg_connection *conn)
+{
+    const char *contentType = mg_get_header(conn, "Content-Type");
+    return contentType && strncmp(contentType, BINARY_CONTENT_TYPE, sizeof(BINARY_CONTENT_TYPE) - 1) == 0;
+}
+
+void sendJsonResponse(struct mg_connection *conn, int status, const char *statusText, const json &response)
+{
+    // messages may echo client bytes that are not valid UTF-8
+    std::string body = response.dump(-1, ' ', false, json::error_handler_t::replace);
+    mg_printf(conn,
+              "HTTP/1.1 %d %s\r\n"
+              "Content-Type: application/json\r\n"
+              "Content-Length: %zu\r\n\r\n",
+              status, statusText, body.size());
+    mg_write(conn, body.data(), body.size());
+}
+
 int handlePostRequest(struct mg_connection *conn, void *cbdata)
 {
     const struct mg_request_info *req_info = mg_get_request_info(conn);
     if (req_info->content_length > 0)
     {
-        std::string post_data(req_info->content_length, '\0');
-        mg_read(conn, &post_data[0], req_info->content_length);
+        std::string post_data;
 
         try
         {
+            if (!readRequestBody(conn, post_data, req_info->content_length))
+            {
+                throw std::runtime_error("Incomplete request body");
+            }
+
             // Assuming QueueCollection is globally accessible or passed as callback data
             QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
             // Parse and process the request data
-            parseCommandV2(post_data, queues);
+            if (isBinaryContentType(conn))
+            {
+                parseBinaryCommand(post_data.data(), post_data.size(), queues);
+            }
+            else
+            {
+                parseCommandV2(post_data, queues);
+            }
 
             // Respond to the request indicating success
             mg_printf(conn,
@@ -150,11 +243,7 @@ int handlePostRequest(struct mg_connection *conn, void *cbdata)
         catch (const std::exception &e)
         {
             // Handle parsing error or processing error
-            mg_printf(conn,
-                      "HTTP/1.1 400 Bad Request\r\n"
-                      "Content-Type: application/json\r\n\r\n"
-                      "{\"error\": \"%s\"}\n",
-                      e.what());
+            sendJsonResponse(conn, 400, "Bad Request", {{"error", e.what()}});
         }
     }
     else
@@ -168,6 +257,342 @@ int handlePostRequest(struct mg_connection *conn, void *cbdata)
     return 200; // Return an HTTP status code
 }
 
+const size_t BATCH_READ_CHUNK_SIZE = 64 * 1024;
+// results listed in a batch response; later messages are only counted
+const size_t BATCH_MAX_RESULTS = 10000;
+
+// Accepts a json array or an NDJSON stream of V2 entity messages. Messages are
+// decoded as the body is read and queued in batches; each of the first
+// BATCH_MAX_RESULTS messages gets its own entry in the response.
+int handleBatchRequest(struct mg_connection *conn, void *cbdata)
+{
+    QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
+    auto start = std::chrono::steady_clock::now();
+
+    JsonDocumentSplitter splitter(BINARY_MAX_FRAME_SIZE);
+    EntityMessageDecoder decoder(&queues.floatBufferPool);
+    IngestBatch batch(queues);
+
+    json results = json::array();
+    size_t documents = 0;
+    size_t accepted = 0;
+    size_t bytesRead = 0;
+
+    auto onDocument = [&](const char *data, size_t length)
+    {
+        json result;
+        result["index"] = documents++;
+        try
+        {
+            result["id"] = submitJsonMessage(data, length, decoder, batch);
+            result["status"] = "success";
+            ++accepted;
+        }
+        catch (const std::exception &e)
+        {
+            result["status"] = "error";
+            result["error"] = e.what();
+        }
+        if (results.size() < BATCH_MAX_RESULTS)
+            results.push_back(std::move(result));
+    };
+
+    std::vector<char> chunk(BATCH_READ_CHUNK_SIZE);
+    int bytes;
+    while ((bytes = mg_read(conn, chunk.data(), chunk.size())) > 0)
+    {
+        bytesRead += bytes;
+        if (!splitter.Feed(chunk.data(), bytes, onDocument))
+        {
+            break;
+        }
+    }
+    batch.Flush();
+
+    json response;
+    response["accepted"] = accepted;
+    response["rejected"] = documents - accepted;
+    if (documents > results.size())
+        response["resultsOmitted"] = documents - results.size();
+    response["results"] = std::move(results);
+
+    if (!splitter.Finished())
+    {
+        response["error"] = splitter.Error().empty() ? "Incomplete request body" : splitter.Error();
+        sendJsonResponse(conn, 400, "Bad Request", response);
+    }
+    else
+    {
+        sendJsonResponse(conn, 200, "OK", response);
+    }
+
+    queues.ingestStats.batchRequests.Record(bytesRead, std::chrono::steady_clock::now() - start, accepted);
+    return 200;
+}
+
+int handleStatsRequest(struct mg_connection *conn, void *cbdata)
+{
+    QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
+    sendJsonResponse(conn, 200, "OK", queues.ingestStats.ToJson());
+    return 200;
+}
+
+const std::chrono::milliseconds FRAME_WAIT_TIMEOUT(2000);
+const int FRAME_STREAM_FRAMES_PER_SECOND = 30;
+const int FRAME_STREAM_MAX_TIMEOUTS = 15;
+
+// Serves the next rendered frame as PNG, or with ?format=raw as top-down
+// RGBA8 pixels sized by the X-Frame-Width and X-Frame-Height headers. Frames
+// are only read back on demand, so the answer comes a few frames after the
+// request
+int handleFrameRequest(struct mg_connection *conn, void *cbdata)
+{
+    QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
+    FrameCapture &capture = *queues.frameCapture;
+
+    const mg_request_info *info = mg_get_request_info(conn);
+    char format[16] = "";
+    if (info->query_string)
+        mg_get_var(info->query_string, strlen(info->query_string), "format", format, sizeof(format));
+    bool raw = std::string(format) == "raw";
+
+    std::shared_ptr<const FrameCapture::Frame> latest = capture.Latest();
+    std::shared_ptr<const FrameCapture::Frame> frame = capture.WaitNewer(latest ? latest->sequence : 0, FRAME_WAIT_TIMEOUT);
+    if (!frame)
+    {
+        sendJsonResponse(conn, 503, "Service Unavailable", {{"status", "error"}, {"error", "No frame rendered yet"}});
+        return 503;
+    }
+
+    const void *data = raw ? static_cast<const void *>(frame->rgba.data()) : static_cast<const void *>(frame->png.data());
+    size_t size = raw ? frame->rgba.size() : frame->png.size();
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: %s\r\n"
+              "Content-Length: %zu\r\n"
+              "Cache-Control: no-store\r\n"
+              "X-Frame-Width: %d\r\n"
+              "X-Frame-Height: %d\r\n"
+              "X-Frame-Sequence: %llu\r\n\r\n",
+              raw ? "application/octet-stream" : "image/png", size, frame->width, frame->height,
+              static_cast<unsigned long long>(frame->sequence));
+    mg_write(conn, data, size);
+    queues.ingestStats.framesServed.fetch_add(1, std::memory_order_relaxed);
+    return 200;
+}
+
+// Writes one PNG part of a frame stream, returning false once the client is gone
+bool sendFramePart(struct mg_connection *conn, const FrameCapture::Frame &frame)
+{
+    return mg_printf(conn, "--frame\r\nContent-Type: image/png\r\nContent-Length: %zu\r\n\r\n", frame.png.size()) > 0 &&
+           mg_write(conn, frame.png.data(), frame.png.size()) > 0 && mg_printf(conn, "\r\n") > 0;
+}
+
+// Streams rendered frames as the PNG parts of a multipart/x-mixed-replace
+// response, the MJPEG-style stream an <img> element plays, at most
+// FRAME_STREAM_FRAMES_PER_SECOND a second. When no new frame comes within
+// FRAME_WAIT_TIMEOUT the last one is sent again, so a client that went away
+// is noticed even while nothing renders; the stream ends then, after
+// FRAME_STREAM_MAX_TIMEOUTS timeouts in a row, or when capture shuts down
+int handleFrameStreamRequest(struct mg_connection *conn, void *cbdata)
+{
+    QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
+    FrameCapture &capture = *queues.frameCapture;
+    const auto interval = std::chrono::microseconds(1000000 / FRAME_STREAM_FRAMES_PER_SECOND);
+
+    FrameCapture::StreamScope stream(capture);
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\n"
+              "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+              "Cache-Control: no-store\r\n"
+              "Connection: close\r\n\r\n");
+
+    uint64_t sequence = 0;
+    int timeouts = 0;
+    while (!capture.Stopping())
+    {
+        auto sendStart = std::chrono::steady_clock::now();
+        std::shared_ptr<const FrameCapture::Frame> frame = capture.WaitNewer(sequence, FRAME_WAIT_TIMEOUT);
+        if (!frame || frame->sequence == sequence)
+        {
+            if (++timeouts >= FRAME_STREAM_MAX_TIMEOUTS)
+                break;
+            // before the first frame there is no part to repeat; padding ahead of
+            // the first boundary is ignored by clients but still probes the socket
+            bool alive = frame ? sendFramePart(conn, *frame) : mg_printf(conn, "\r\n") > 0;
+            if (!alive)
+                break;
+            continue;
+        }
+        timeouts = 0;
+        sequence = frame->sequence;
+
+        if (!sendFramePart(conn, *frame))
+            break;
+        queues.ingestStats.framesServed.fetch_add(1, std::memory_order_relaxed);
+        std::this_thread::sleep_until(sendStart + interval);
+    }
+    return 200;
+}
+
+const int64_t WEBSOCKET_REPORT_INTERVAL_NANOSECONDS = 1000000000;
+
+// Per-connection state for producers streaming entity messages over /stream.
+// Text frames carry json messages (one or more, as an array or NDJSON) and
+// binary frames carry back-to-back binary entity frames; either may be split
+// across websocket frames.
+struct WebSocketProducer
+{
+    JsonDocumentSplitter splitter;
+    EntityMessageDecoder decoder;
+    std::string binaryPending;
+    int lastOpcode = MG_WEBSOCKET_OPCODE_TEXT;
+
+    int64_t connectedAt = IngestStats::NowNanoseconds();
+    int64_t lastReport = connectedAt;
+    int64_t lastPush = 0;
+
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t messages = 0;
+    uint64_t rejected = 0;
+
+    WebSocketProducer(QueueCollection &queues) : splitter(BINARY_MAX_FRAME_SIZE), decoder(&queues.floatBufferPool) {}
+
+    json Report(const QueueCollection &queues) const
+    {
+        double seconds = (IngestStats::NowNanoseconds() - connectedAt) / 1e9;
+
+        json report;
+        report["type"] = "stats";
+        report["frames"] = frames;
+        report["messages"] = messages;
+        report["rejected"] = rejected;
+        report["bytes"] = bytes;
+        report["messagesPerSecond"] = seconds > 0 ? messages / seconds : 0.0;
+        report["megabytesPerSecond"] = seconds > 0 ? (bytes / 1e6) / seconds : 0.0;
+        report["lagMs"] = lastPush ? queues.ingestStats.LagMilliseconds(lastPush) : 0.0;
+        report["queuedBatches"] = queues.entityCreationV2Queue.Size();
+        return report;
+    }
+};
+
+void sendWebSocketJson(struct mg_connection *conn, const json &message)
+{
+    std::string text = message.dump();
+    mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_TEXT, text.data(), text.size());
+}
+
+int websocketConnectHandler(const struct mg_connection *conn, void *cbdata)
+{
+    QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
+    mg_set_user_connection_data(conn, new WebSocketProducer(queues));
+    queues.ingestStats.websocketConnections++;
+    return 0;
+}
+
+int websocketDataHandler(struct mg_connection *conn, int bits, char *data, size_t length, void *cbdata)
+{
+    QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
+    WebSocketProducer *producer = static_cast<WebSocketProducer *>(mg_get_user_connection_data(conn));
+    if (!producer)
+        return 0;
+
+    int opcode = bits & 0x0f;
+    if (opcode == MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE)
+        return 0;
+    if (opcode == MG_WEBSOCKET_OPCODE_PING || opcode == MG_WEBSOCKET_OPCODE_PONG)
+        return 1;
+    if (opcode == MG_WEBSOCKET_OPCODE_CONTINUATION)
+        opcode = producer->lastOpcode;
+    producer->lastOpcode = opcode;
+
+    auto start = std::chrono::steady_clock::now();
+    IngestBatch batch(queues);
+    uint64_t accepted = 0;
+    bool keepOpen = true;
+
+    if (opcode == MG_WEBSOCKET_OPCODE_TEXT)
+    {
+        auto onDocument = [&](const char *document, size_t documentLength)
+        {
+            try
+            {
+                submitJsonMessage(document, documentLength, producer->decoder, batch);
+                ++accepted;
+            }
+            catch (const std::exception &e)
+            {
+                ++producer->rejected;
+                sendWebSocketJson(conn, json{{"type", "error"}, {"error", e.what()}});
+            }
+        };
+        if (!producer->splitter.Feed(data, length, onDocument))
+        {
+            sendWebSocketJson(conn, json{{"type", "error"}, {"error", producer->splitter.Error()}});
+            keepOpen = false;
+        }
+    }
+    else if (opcode == MG_WEBSOCKET_OPCODE_BINARY)
+    {
+        std::string &pending = producer->binaryPending;
+        pending.append(data, length);
+
+        size_t offset = 0;
+        BinaryFrameHeader header;
+        while (BinaryEntityCodec::ReadHeader(pending.data() + offset, pending.size() - offset, header))
+        {
+            if (header.magic != BINARY_PROTOCOL_MAGIC || header.FrameLength() > BINARY_MAX_FRAME_SIZE)
+            {
+                sendWebSocketJson(conn, json{{"type", "error"}, {"error", "bad binary frame"}});
+                keepOpen = false;
+                break;
+            }
+            if (header.FrameLength() > pending.size() - offset)
+                break;
+
+            try
+            {
+                submitBinaryMessage(pending.data() + offset, header.FrameLength(), batch);
+                ++accepted;
+            }
+            catch (const std::exception &e)
+            {
+                ++producer->rejected;
+                sendWebSocketJson(conn, json{{"type", "error"}, {"error", e.what()}});
+            }
+            offset += header.FrameLength();
+        }
+        pending.erase(0, offset);
+    }
+
+    batch.Flush();
+
+    producer->frames++;
+    producer->bytes += length;
+    producer->messages += accepted;
+    if (accepted)
+        producer->lastPush = IngestStats::NowNanoseconds();
+    queues.ingestStats.websocketIngest.Record(length, std::chrono::steady_clock::now() - start, accepted);
+
+    int64_t now = IngestStats::NowNanoseconds();
+    if (now - producer->lastReport >= WEBSOCKET_REPORT_INTERVAL_NANOSECONDS)
+    {
+        sendWebSocketJson(conn, producer->Report(queues));
+        producer->lastReport = now;
+    }
+
+    return keepOpen ? 1 : 0;
+}
+
+void websocketCloseHandler(const struct mg_connection *conn, void *cbdata)
+{
+    QueueCollection &queues = *static_cast<QueueCollection *>(cbdata);
+    delete static_cast<WebSocketProducer *>(mg_get_user_connection_data(conn));
+    mg_set_user_connection_data(conn, nullptr);
+    queues.ingestStats.websocketConnections--;
+}
+
 void ServerThreadV2(QueueCollection &queues)
 {
     const char *options[] = {
@@ -185,6 +610,19 @@ void ServerThreadV2(QueueCollection &queues)
     }
 
     mg_set_request_handler(ctx, "/entity", handlePostRequest, static_cast<void *>(&queues));
+    mg_set_request_handler(ctx, "/entities", handleBatchRequest, static_cast<void *>(&queues));
+    mg_set_websocket_handler(ctx, "/stream",
+                             websocketConnectHandler,
+                             nullptr,
+                             websocketDataHandler,
+                             websocketCloseHandler,
+                             static_cast<void *>(&queues));
+    mg_set_request_handler(ctx, "/stats", handleStatsRequest, static_cast<void *>(&queues));
+    if (queues.frameCapture)
+    {
+        mg_set_request_handler(ctx, "/frame", handleFrameRequest, static_cast<void *>(&queues));
+        mg_set_request_handler(ctx, "/frame/stream", handleFrameStreamRequest, static_cast<void *>(&queues));
+    }
 
     std::cout << "CivetWeb server started. Press Enter to stop.\n";
     std::cin.get();
@@ -192,21 +630,155 @@ void ServerThreadV2(QueueCollection &queues)
     mg_stop(ctx);
 }
 
+const int TCP_INGEST_PORT = 8081;
+const int TCP_MAX_EVENTS = 128;
+const size_t TCP_READ_CHUNK_SIZE = 64 * 1024;
+const size_t TCP_MAX_LINE_LENGTH = BINARY_MAX_FRAME_SIZE;
+// acknowledgements held for a peer that is not reading them; past this the
+// connection's commands are left unread until the outbox drains
+const size_t TCP_MAX_OUTBOX_SIZE = 1024 * 1024;
+
+// Per-connection state for the raw socket server. Commands are framed either
+// as newline-terminated text (CREATE/DELETE/COLOR or a single-line V2 json
+// message) or as length-prefixed binary frames starting with the DYGL magic.
+struct TcpConnection
+{
+    int fd = -1;
+    std::string inbox;  // received bytes not yet consumed by a complete command
+    std::string outbox; // acknowledgements not yet written to the socket
+    uint32_t interest = EPOLLIN | EPOLLRDHUP; // events registered with epoll
+
+    TcpConnection() = default;
+    explicit TcpConnection(int fd) : fd(fd) {}
+};
+
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Consumes the complete commands in the connection's inbox, queueing an
+// acknowledgement for each one, until the outbox is full. Returns false if
+// the stream is unusable.
+bool processInbox(TcpConnection &connection, IngestBatch &batch, uint64_t &commands)
+{
+    std::string &inbox = connection.inbox;
+    size_t offset = 0;
+
+    while (offset < inbox.size() && connection.outbox.size() < TCP_MAX_OUTBOX_SIZE)
+    {
+        const char *data = inbox.data() + offset;
+        size_t available = inbox.size() - offset;
+        std::string error;
+
+        if (BinaryEntityCodec::IsBinaryFrame(data, available))
+        {
+            BinaryFrameHeader header;
+            if (!BinaryEntityCodec::ReadHeader(data, available, header))
+                break;
+            if (header.FrameLength() > BINARY_MAX_FRAME_SIZE)
+                return false;
+            if (header.FrameLength() > available)
+                break;
+
+            try
+            {
+                submitBinaryMessage(data, header.FrameLength(), batch);
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+            offset += header.FrameLength();
+        }
+        else
+        {
+            const char *newline = static_cast<const char *>(memchr(data, '\n', available));
+            if (!newline)
+            {
+                if (available > TCP_MAX_LINE_LENGTH)
+                    return false;
+                break;
+            }
+
+            size_t lineLength = newline - data;
+            offset += lineLength + 1;
+            if (lineLength > 0 && data[lineLength - 1] == '\r')
+                --lineLength;
+            if (lineLength == 0)
+                continue;
+
+            try
+            {
+                parseCommand(std::string(data, lineLength), batch);
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+        }
+
+        // acknowledgements are pipelined: one per command, in command order
+        connection.outbox += error.empty() ? "ACK\n" : "ERR " + error + "\n";
+        ++commands;
+    }
+
+    inbox.erase(0, offset);
+    return true;
+}
+
+// Writes as much of the outbox as the socket accepts. Returns false on error.
+bool flushOutbox(TcpConnection &connection)
+{
+    while (!connection.outbox.empty())
+    {
+        ssize_t sent = send(connection.fd, connection.outbox.data(), connection.outbox.size(), MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        connection.outbox.erase(0, sent);
+    }
+    return true;
+}
+
+// Waits for writability while acknowledgements are pending, and stops
+// reading while the outbox is full so a peer that never reads cannot grow it
+void updateInterest(int epoll_fd, TcpConnection &connection)
+{
+    uint32_t interest = connection.outbox.size() < TCP_MAX_OUTBOX_SIZE ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0u;
+    if (!connection.outbox.empty())
+        interest |= EPOLLOUT;
+    if (interest == connection.interest)
+        return;
+
+    epoll_event event{};
+    event.events = interest;
+    event.data.fd = connection.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.interest = interest;
+}
+
 void ServerThread(QueueCollection &queues)
 {
     int server_fd;
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
 
+    int reuse = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(8081);
+    address.sin_port = htons(TCP_INGEST_PORT);
 
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
     {
@@ -214,40 +786,138 @@ void ServerThread(QueueCollection &queues)
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd, 3) < 0)
+    if (listen(server_fd, SOMAXCONN) < 0 || !setNonBlocking(server_fd))
     {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+    {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    epoll_event listenEvent{};
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.fd = server_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &listenEvent);
+
     std::cout << "Server started. Listening for connections..." << std::endl;
 
-    // Outer loop added to continuously accept new connections
+    std::unordered_map<int, TcpConnection> connections;
+    std::vector<char> chunk(TCP_READ_CHUNK_SIZE);
+    epoll_event events[TCP_MAX_EVENTS];
+
+    auto closeConnection = [&](int fd)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+        queues.ingestStats.tcpConnections--;
+    };
+
     while (true)
     {
-        int new_socket;
-        if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen)) < 0)
+        int ready = epoll_wait(epoll_fd, events, TCP_MAX_EVENTS, -1);
+        if (ready < 0)
         {
-            perror("accept");
-            continue; // Don't exit the program, just wait for the next connection
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
         }
 
-        // Process the connection
-        char buffer[1024] = {0};
-        while (true)
+        auto start = std::chrono::steady_clock::now();
+        // one batch per wakeup: commands from every ready connection share a queue push
+        IngestBatch batch(queues);
+        uint64_t bytesRead = 0;
+        uint64_t commands = 0;
+
+        for (int i = 0; i < ready; ++i)
         {
-            int bytes_read = read(new_socket, buffer, 1024);
-            if (bytes_read <= 0)
+            int fd = events[i].data.fd;
+
+            if (fd == server_fd)
             {
-                std::cout << "Client disconnected or error." << std::endl;
-                break; // Break from processing loop, not from accept loop
+                int new_socket;
+                while ((new_socket = accept(server_fd, nullptr, nullptr)) >= 0)
+                {
+                    setNonBlocking(new_socket);
+                    epoll_event event{};
+                    event.events = EPOLLIN | EPOLLRDHUP;
+                    event.data.fd = new_socket;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_socket, &event);
+                    connections[new_socket] = TcpConnection{new_socket};
+                    queues.ingestStats.tcpConnections++;
+                }
+                continue;
             }
-            std::cout << "Message Received: beg " << buffer << " end" << std::endl;
-            parseCommand(buffer, queues);
-            send(new_socket, "ACK\n", 4, 0); // Send back an acknowledgement
+
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                continue;
+            TcpConnection &connection = it->second;
+            bool open = true;
+
+            if (events[i].events & EPOLLIN)
+            {
+                // bounded per wakeup so one busy producer cannot starve the others
+                for (int reads = 0; reads < 16; ++reads)
+                {
+                    ssize_t bytes = read(fd, chunk.data(), chunk.size());
+                    if (bytes > 0)
+                    {
+                        connection.inbox.append(chunk.data(), bytes);
+                        bytesRead += bytes;
+                        continue;
+                    }
+                    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        break;
+                    // orderly shutdown or error; commands already received are still applied
+                    open = false;
+                    break;
+                }
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                open = false;
+
+            // acknowledge what was received even if the peer is closing. Commands
+            // held back by a full outbox go through once a flush drains it
+            bool usable = true;
+            while (usable)
+            {
+                if (!processInbox(connection, batch, commands))
+                {
+                    std::cerr << "Dropping connection with oversized frame." << std::endl;
+                    usable = false;
+                    break;
+                }
+                bool full = connection.outbox.size() >= TCP_MAX_OUTBOX_SIZE;
+                if (!flushOutbox(connection))
+                    usable = false;
+                else if (!full || !connection.outbox.empty())
+                    break;
+            }
+            open = open && usable;
+
+            if (open)
+                updateInterest(epoll_fd, connection);
+            else
+                closeConnection(fd);
+        }
+
+        batch.Flush();
+        if (bytesRead > 0)
+        {
+            queues.ingestStats.tcpIngest.Record(bytesRead, std::chrono::steady_clock::now() - start, commands);
         }
-        close(new_socket); // Close the current connection before accepting a new one
     }
+
+    close(epoll_fd);
+    close(server_fd);
 }
 
 std::string createEntityCommand(int id, const std::string &type, float x, float y, float z)
@@ -420,15 +1090,64 @@ void ClientThread()
     }
 }
 
-int main()
+// Reads the startup options:
+//   --headless          render offscreen without a window (EGL or OSMesa)
+//   --size WIDTHxHEIGHT framebuffer size, 800x600 by default
+//   --frames N          exit after N frames, for repeatable benchmarks
+AppOptions parseOptions(int argc, char **argv)
 {
+    AppOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (argument == "--size" && i + 1 < argc)
+        {
+            int width = 0, height = 0;
+            if (sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+            {
+                options.width = width;
+                options.height = height;
+            }
+            else
+            {
+                std::cerr << "Ignoring --size " << argv[i] << ", expected WIDTHxHEIGHT" << std::endl;
+            }
+        }
+        else if (argument == "--frames" && i + 1 < argc)
+        {
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            std::cerr << "Unknown option " << argument << std::endl;
+        }
+    }
+    return options;
+}
+
+int main(int argc, char **argv)
+{
+    AppOptions options = parseOptions(argc, argv);
     QueueCollection queues;
+    MeshPipeline meshPipeline(queues); // interleaves incoming meshes off the render thread
+    queues.meshPipeline = &meshPipeline;
+    FrameCapture frameCapture(queues.ingestStats); // encodes frames read back for /frame
+    queues.frameCapture = &frameCapture;
     std::thread server2Thread(ServerThread, std::ref(queues));
     std::thread serverThread(ServerThreadV2, std::ref(queues));
     std::thread clientThread(ClientThread);
-    OpenGLApp openglApp(queues); // Adjust constructor to accept QueueCollection
+    OpenGLApp openglApp(queues, options);
     openglApp.Initialize();
     openglApp.Run();
+    if (options.frames > 0)
+    {
+        // a benchmark run ends with its frames; the server threads never return
+        std::exit(0);
+    }
     server2Thread.join();
     serverThread.join();
     // Ensure the server thread has completed before exiting the program
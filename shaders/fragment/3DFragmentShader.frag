@@ -3,23 +3,30 @@ out vec4 FragColor;
 
 in vec3 Normal; // For basic lighting
 in vec3 FragmentPos; // For basic lighting
+in vec4 VertexColor;
 
 uniform vec4 ourColor; // Updated to vec4
-uniform vec3 lightColor;
-uniform vec3 lightPos;
+layout (std140) uniform Scene
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;   // xyz
+    vec4 lightColor; // rgb
+};
 
 void main()
 {
     // Ambient lighting
     float ambientStrength = 0.75;
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientStrength * lightColor.rgb;
   
     // Diffuse lighting
-    vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragmentPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor; 
+    // meshes without normals are lit by the ambient term only
+    vec3 lightDir = normalize(lightPos.xyz - FragmentPos);
+    float diff = dot(Normal, Normal) > 0.0 ? max(dot(normalize(Normal), lightDir), 0.0) : 0.0;
+    vec3 diffuse = diff * lightColor.rgb; 
     
-    vec3 result = (ambient + diffuse) * ourColor.rgb; // Use .rgb to multiply with vec3 light components
-    FragColor = vec4(result, ourColor.a); // Use ourColor's alpha for the final color
+    vec4 color = ourColor * VertexColor;
+    vec3 result = (ambient + diffuse) * color.rgb; // Use .rgb to multiply with vec3 light components
+    FragColor = vec4(result, color.a); // Use the color's alpha for the final color
 }
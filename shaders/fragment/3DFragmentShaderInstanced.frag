@@ -0,0 +1,30 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 Normal; // For basic lighting
+in vec3 FragmentPos; // For basic lighting
+
+in vec4 InstanceColor; // Per instance color from the vertex shader
+layout (std140) uniform Scene
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;   // xyz
+    vec4 lightColor; // rgb
+};
+
+void main()
+{
+    // Ambient lighting
+    float ambientStrength = 0.75;
+    vec3 ambient = ambientStrength * lightColor.rgb;
+  
+    // Diffuse lighting
+    // meshes without normals are lit by the ambient term only
+    vec3 lightDir = normalize(lightPos.xyz - FragmentPos);
+    float diff = dot(Normal, Normal) > 0.0 ? max(dot(normalize(Normal), lightDir), 0.0) : 0.0;
+    vec3 diffuse = diff * lightColor.rgb; 
+    
+    vec3 result = (ambient + diffuse) * InstanceColor.rgb; // Use .rgb to multiply with vec3 light components
+    FragColor = vec4(result, InstanceColor.a); // Use InstanceColor's alpha for the final color
+}
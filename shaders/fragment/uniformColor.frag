@@ -1,7 +1,8 @@
 #version 330 core
 uniform vec4 ourColor; // Uniform input
+in vec4 VertexColor;    // white when the mesh has no colors
 out vec4 FragColor;
 
 void main() {
-    FragColor = ourColor; // Use the uniform color
+    FragColor = ourColor * VertexColor; // Use the uniform color
 }
\ No newline at end of file
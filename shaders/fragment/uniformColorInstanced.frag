@@ -0,0 +1,7 @@
+#version 330 core
+in vec4 InstanceColor; // Per instance color from the vertex shader
+out vec4 FragColor;
+
+void main() {
+    FragColor = InstanceColor;
+}
@@ -1,17 +1,36 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal; // For basic lighting
+layout (location = 7) in vec4 aNormal; // octahedral, for basic lighting
+layout (location = 8) in vec4 aColor;  // per vertex, white when the mesh has none
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Scene
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;   // xyz
+    vec4 lightColor; // rgb
+};
 
 out vec3 Normal; // For basic lighting
 out vec3 FragmentPos; // For basic lighting
+out vec4 VertexColor;
+
+// Undoes the octahedral mapping normals are stored in; w is 0 when the mesh has none
+vec3 octahedralDecode(vec4 encoded)
+{
+    if (encoded.w == 0.0)
+        return vec3(0.0);
+    vec3 n = vec3(encoded.xy, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
     FragmentPos = vec3(model * vec4(aPos, 1.0)); // For basic lighting
-    Normal = aNormal; // For basic lighting
+    Normal = octahedralDecode(aNormal); // For basic lighting
+    VertexColor = aColor;
 }
\ No newline at end of file
@@ -1,10 +1,19 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 8) in vec4 aColor; // per vertex, white when the mesh has none
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Scene
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;   // xyz
+    vec4 lightColor; // rgb
+};
+
+out vec4 VertexColor;
 
 void main() {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
+    VertexColor = aColor;
 }
\ No newline at end of file
@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in mat4 aModel; // per instance, locations 2-5
+layout (location = 6) in vec4 aColor; // per instance
+layout (location = 8) in vec4 aVertexColor; // white when the mesh has none
+
+layout (std140) uniform Scene
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;   // xyz
+    vec4 lightColor; // rgb
+};
+
+out vec4 InstanceColor;
+
+void main() {
+    gl_Position = projection * view * aModel * vec4(aPos, 1.0);
+    InstanceColor = aColor * aVertexColor;
+}
@@ -5,8 +5,13 @@ layout (location = 1) in vec2 aTexCoord; // Texture coordinates
 out vec2 TexCoord; // Pass texture coordinates to fragment shader
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Scene
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;   // xyz
+    vec4 lightColor; // rgb
+};
 
 void main() {
     TexCoord = aTexCoord;
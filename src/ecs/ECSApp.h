@@ -11,20 +11,37 @@
 #include <glfw3.h>
 #include <iostream>
 #include "RenderPreprocessorSystem.h"
+#include "CullingSystem.h"
 #include "TextOverlaySystem.h"
 #include <sstream>
 #include <iomanip>
+#include <chrono>
 #include "KeyboardInputSystem.h"
 #include "FeedProcessorSystem.h"
 #include "SystemLogger.h"
 #include "GameStateSystem.h"
+#include "ShaderWatcher.h"
+#include "HeadlessContext.h"
+#include "OffscreenFramebuffer.h"
+#include "FrameReadback.h"
 
 #pragma region ClassDeclaration
 
+// Startup options of OpenGLApp
+struct AppOptions
+{
+    // render into an offscreen framebuffer of a headless context: no window,
+    // no display server and no input callbacks
+    bool headless = false;
+    int width = 800;
+    int height = 600;
+    uint64_t frames = 0; // frames to render before Run returns, 0 to run until the window closes
+};
+
 class OpenGLApp
 {
 public:
-    OpenGLApp(QueueCollection &queueCollection);
+    OpenGLApp(QueueCollection &queueCollection, const AppOptions &options = AppOptions());
     void Initialize();
     void Run();
 
@@ -36,6 +53,16 @@ public:
 private:
     void initialize();
     void setupWindow();
+    void createWindow();
+    void createHeadlessContext();
+    bool running(uint64_t frame) const;
+    void reloadShaders();
+
+    AppOptions options;
+    // declared before everything holding GL objects, so the context outlives them
+    HeadlessContext headlessContext;
+    OffscreenFramebuffer offscreenFramebuffer;
+    FrameReadback frameReadback;
 
     EventBus eventBus;
     EntityManager entityManager;
@@ -48,25 +75,38 @@ private:
     SystemLogger logger;
 
     UniformManager uniformManager;
-
-    GLFWwindow *window;
+    GeometryArena geometryArena;
+    StreamBuffer streamBuffer;
+    GeometryCache geometryCache;
+    RenderQueue renderQueue;
+    ShaderManager shaderManager;
+    ShaderWatcher shaderWatcher;
+
+    GLFWwindow *window = nullptr;
+    GLADloadproc getProcAddress = nullptr;
 };
 
 #pragma endregion
 
 #pragma region Constructor
 
-OpenGLApp::OpenGLApp(QueueCollection &queueCollection)
-    : queueCollection(queueCollection),
+OpenGLApp::OpenGLApp(QueueCollection &queueCollection, const AppOptions &options)
+    : options(options),
+      frameReadback(queueCollection.ingestStats),
       entityManager(eventBus),
-      context(SceneContext(800, 600, glm::vec3(0.0f, 0.0f, 5.0f))),
-      uniformManager(context, componentManager),
-      systemManager()
+      systemManager(),
+      queueCollection(queueCollection),
+      context(SceneContext(options.width, options.height, glm::vec3(0.0f, 0.0f, 5.0f))),
+      uniformManager(context, componentManager, eventBus),
+      geometryArena(queueCollection.ingestStats),
+      streamBuffer(queueCollection.ingestStats),
+      geometryCache(queueCollection.ingestStats, geometryArena),
+      renderQueue(queueCollection.ingestStats)
 {
     systemManager.AddSystem<GameStateSystem>(entityManager, componentManager);
 
     // input
-    systemManager.AddSystem<MessageSystem>(entityManager, componentManager, queueCollection, eventBus);
+    systemManager.AddSystem<MessageSystem>(entityManager, componentManager, queueCollection, eventBus, geometryCache, geometryArena);
     systemManager.AddSystem<MouseSystem>(entityManager, componentManager, context);
     systemManager.AddSystem<KeyboardInputSystem>(entityManager, componentManager, &logger);
 
@@ -76,8 +116,10 @@ OpenGLApp::OpenGLApp(QueueCollection &queueCollection)
     systemManager.AddSystem<TextOverlaySystem>(entityManager, componentManager);
 
     // render
-    systemManager.AddSystem<RenderSystem>(context, uniformManager);
-    systemManager.AddSystem<RenderPreprocessorSystem>(componentManager, uniformManager);
+    systemManager.AddSystem<RenderSystem>(context, uniformManager, shaderManager, renderQueue, streamBuffer);
+    systemManager.AddSystem<RenderPreprocessorSystem>(componentManager, uniformManager, geometryCache, geometryArena, streamBuffer,
+                                                      shaderManager, renderQueue);
+    systemManager.AddSystem<CullingSystem>(componentManager, context, renderQueue);
 
     // internals
     systemManager.AddSystem<FeedProcessorSystem>(entityManager, componentManager, &logger);
@@ -89,36 +131,45 @@ OpenGLApp::OpenGLApp(QueueCollection &queueCollection)
 
 void OpenGLApp::Initialize()
 {
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-    glfwWindowHint(GLFW_DEPTH_BITS, 24);
-
-    window = glfwCreateWindow(800, 600, "Render System Usage", NULL, NULL);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    auto initializeStart = std::chrono::steady_clock::now();
+    if (options.headless)
+        createHeadlessContext();
+    else
+        createWindow();
 
-    if (window == NULL)
+    if (!gladLoadGLLoader(getProcAddress))
     {
-        std::cerr << "Failed to create GLFW window\n";
-        glfwTerminate();
+        std::cerr << "Failed to initialize GLAD\n";
         exit(-1);
     }
-    glfwMakeContextCurrent(window);
-    setupWindow();
-    initialize();
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    if (options.headless)
     {
-        std::cerr << "Failed to initialize GLAD\n";
-        exit(-1);
+        if (!offscreenFramebuffer.Create(options.width, options.height))
+            exit(-1);
+        offscreenFramebuffer.Bind();
+        std::cout << "Rendering offscreen at " << options.width << "x" << options.height << " (" << glGetString(GL_RENDERER) << ")"
+                  << std::endl;
     }
-    systemManager.GetSystem<RenderSystem>().Initialize();
+
+    streamBuffer.Initialize(getProcAddress);
+
+    // compile (or load from the binary cache) every program used by earlier
+    // runs now, instead of on first appearance inside the frame loop
+    auto warmUpStart = std::chrono::steady_clock::now();
+    shaderManager.EnableBinaryCache(getProcAddress);
+    size_t warmedPrograms = shaderManager.WarmUp();
+    double warmUpMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - warmUpStart).count();
+
+    systemManager.GetSystem<RenderSystem>().Initialize(getProcAddress);
     systemManager.GetSystem<GameStateSystem>().Initialize();
     systemManager.GetSystem<TextOverlaySystem>().Initialize("fonts/Nanum-Gothic-Coding/NanumGothicCoding-Regular.ttf");
+    shaderWatcher.Start();
+
+    double initializeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - initializeStart).count();
+    std::cout << "Startup: initialize " << initializeMilliseconds << " ms, shader warm-up " << warmUpMilliseconds << " ms ("
+              << warmedPrograms << " programs, " << shaderManager.ProgramsFromBinaryCache() << " from binary cache, "
+              << shaderManager.ProgramsCompiled() << " compiled)" << std::endl;
 }
 
 void OpenGLApp::Run()
@@ -129,12 +180,19 @@ void OpenGLApp::Run()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    while (!glfwWindowShouldClose(window))
+    bool firstFrame = true;
+    uint64_t frame = 0;
+    auto runStart = std::chrono::steady_clock::now();
+    while (running(frame))
     {
+        auto frameStart = std::chrono::steady_clock::now();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         float delta = 0.016f;
 
+        // frame boundary: swap in shaders edited since the last frame
+        reloadShaders();
+
         systemManager.GetSystem<GameStateSystem>().Update(delta);
 
         // input type systems
@@ -155,16 +213,51 @@ void OpenGLApp::Run()
         // visualization type systems
         systemManager.GetSystem<RenderPreprocessorSystem>()
             .Update(0.016f);
+        systemManager.GetSystem<CullingSystem>().Update(0.016f);
         systemManager.GetSystem<RenderSystem>().UpdateV4(0.016f, componentManager);
+        streamBuffer.EndFrame();
 
         systemManager.GetSystem<FeedProcessorSystem>().Update(0.016f);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (queueCollection.frameCapture)
+        {
+            int width = options.width, height = options.height;
+            if (window)
+                glfwGetFramebufferSize(window, &width, &height);
+            frameReadback.Capture(*queueCollection.frameCapture, width, height);
+        }
+
+        if (window)
+        {
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+        else
+        {
+            // nothing presents the offscreen frame, so submit it here
+            glFlush();
+        }
+        ++frame;
+
+        if (firstFrame)
+        {
+            glFinish();
+            double frameMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+            std::cout << "Startup: first frame " << frameMilliseconds << " ms" << std::endl;
+            firstFrame = false;
+        }
     }
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    double runMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+    std::cout << "Rendered " << frame << " frames in " << runMilliseconds << " ms ("
+              << (frame ? runMilliseconds / frame : 0.0) << " ms per frame)" << std::endl;
+
+    // the headless context is released with the app, after the GL objects using it
+    if (window)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 }
 
 #pragma endregion
@@ -287,6 +380,53 @@ void OpenGLApp::keypressCallback(GLFWwindow *window, int key, int scancode, int
 
 #pragma region PrivateMethods
 
+void OpenGLApp::createWindow()
+{
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+
+    window = glfwCreateWindow(options.width, options.height, "Render System Usage", NULL, NULL);
+    if (window == NULL)
+    {
+        std::cerr << "Failed to create GLFW window\n";
+        glfwTerminate();
+        exit(-1);
+    }
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwMakeContextCurrent(window);
+    setupWindow();
+    initialize();
+    getProcAddress = (GLADloadproc)glfwGetProcAddress;
+}
+
+void OpenGLApp::createHeadlessContext()
+{
+    if (!headlessContext.Create())
+        exit(-1);
+    getProcAddress = HeadlessContext::GetProcAddress;
+}
+
+bool OpenGLApp::running(uint64_t frame) const
+{
+    if (options.frames > 0 && frame >= options.frames)
+        return false;
+    return !window || !glfwWindowShouldClose(window);
+}
+
+void OpenGLApp::reloadShaders()
+{
+    for (auto &change : shaderWatcher.DrainChanges())
+    {
+        shaderManager.ReloadShaderSource(change.path, change.source);
+    }
+}
+
 void OpenGLApp::initialize()
 {
     glfwSetMouseButtonCallback(window, OpenGLApp::staticMouseButtonCallback);
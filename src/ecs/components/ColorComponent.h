@@ -8,7 +8,7 @@ struct ColorComponent
     float targetR, targetG, targetB;
     float interpolationSpeed;
 
-    bool dirty;
+    bool dirty = false;
 
     ColorComponent(float r = 1.0f, float g = 1.0f, float b = 1.0f, float interpolationSpeed = 0.01f)
         : r(r), g(g), b(b), targetR(r), targetG(g), targetB(b), interpolationSpeed(interpolationSpeed) {}
@@ -21,12 +21,17 @@ struct ColorComponent
         targetB = newB;
     }
 
-    // Update the current color towards the target color
-    void UpdateColor()
+    // Update the current color towards the target color, returning true if it changed
+    bool UpdateColor()
     {
+        if (r == targetR && g == targetG && b == targetB)
+        {
+            return false;
+        }
         r = UpdateChannel(r, targetR);
         g = UpdateChannel(g, targetG);
         b = UpdateChannel(b, targetB);
+        return true;
     }
 
 private:
@@ -2,19 +2,48 @@
 
 #include <glm.hpp>
 #include <gtc/matrix_transform.hpp>
+#include <cstdint>
 #include <vector>
 #include "Vertex.h"
 
 struct GeometryComponent
 {
   std::vector<Vertex> vertices;
-  bool dirty;
+  // triangles as indices into vertices; empty to draw every three vertices as one
+  std::vector<uint32_t> indices;
+  bool dirty = false;
+  // object space bounding box, valid when hasBounds is set
+  glm::vec3 boundsMin{0.0f};
+  glm::vec3 boundsMax{0.0f};
+  bool hasBounds = false;
+  // GeometryCache entry holding the vertices, or 0 when they live in vertices above
+  uint64_t meshKey = 0;
   // Default constructor
   GeometryComponent() = default;
   
   // Constructor that initializes vertices
   GeometryComponent(const std::vector<Vertex> &verts) : vertices(verts) {}
+  // Constructor that takes ownership of already built vertices
+  GeometryComponent(std::vector<Vertex> &&verts) : vertices(std::move(verts)) {}
+  // Constructor for indexed geometry
+  GeometryComponent(std::vector<Vertex> &&verts, std::vector<uint32_t> &&triangleIndices)
+      : vertices(std::move(verts)), indices(std::move(triangleIndices)) {}
   // Constructor that initializes vertices
   // GeometryComponent(const std::vector<float> &verts, int size, int stride) {}
 
+  // Recomputes the object space bounds from vertices; cached meshes carry theirs
+  void ComputeBounds()
+  {
+    hasBounds = !vertices.empty();
+    if (!hasBounds)
+      return;
+    boundsMin = boundsMax = glm::vec3(vertices[0].x, vertices[0].y, vertices[0].z);
+    for (const Vertex &vertex : vertices)
+    {
+      glm::vec3 position(vertex.x, vertex.y, vertex.z);
+      boundsMin = glm::min(boundsMin, position);
+      boundsMax = glm::max(boundsMax, position);
+    }
+  }
+
 };
\ No newline at end of file
@@ -1,3 +1,8 @@
+#pragma once
+#include <glad.h>
+#include <cstdint>
+#include "VertexFormat.h"
+
 // struct RenderComponent
 // {
 //     unsigned int VAO;
@@ -31,6 +36,9 @@ struct RenderComponent
     unsigned int VBO;
     GLsizei vertexCount; // Stores the number of vertices to be drawn
     GLsizeiptr bufferSize; // Stores the size of the buffer in bytes
+    uint32_t arenaRange = 0; // GeometryArena range holding the vertices
+    bool ownsRange = false;  // false when the range belongs to a GeometryCache entry
+    PositionDecode decode;   // of the range's positions, folded into the model matrix
 
     RenderComponent() = default;
 
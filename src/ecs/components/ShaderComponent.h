@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <iostream>
 
@@ -6,7 +7,10 @@ struct ShaderComponent {
     // filenames of shaders
     std::string vertexShader;
     std::string fragmentShader;
+    // ShaderManager slot holding the linked program for the pair, resolved once by
+    // RenderPreprocessorSystem; 0 until then
+    uint32_t programSlot = 0;
 
     ShaderComponent() = default;
-    ShaderComponent(std::string vertexShader, std::string fragmentShader): vertexShader(vertexShader), fragmentShader(fragmentShader) {};
+    ShaderComponent(std::string vertexShader, std::string fragmentShader): vertexShader(std::move(vertexShader)), fragmentShader(std::move(fragmentShader)) {};
 };
\ No newline at end of file
@@ -9,7 +9,7 @@ struct TransformComponent
     glm::vec3 scale;
     glm::vec3 rotation;
 
-    bool dirty;
+    bool dirty = false;
 
     // Constructor to initialize the position, scale, and rotation
     TransformComponent(float x = 0.0f, float y = 0.0f, float z = 0.0f,
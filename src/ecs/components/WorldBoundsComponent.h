@@ -0,0 +1,13 @@
+#pragma once
+
+#include <glm.hpp>
+
+// World space bounds of a drawable entity, kept by RenderPreprocessorSystem
+// from its GeometryComponent bounds and model matrix, and read by CullingSystem
+struct WorldBoundsComponent
+{
+    glm::vec3 center{0.0f};
+    glm::vec3 extents{0.0f}; // half size of the axis aligned box around the entity
+    float radius = 0.0f;     // bounding sphere around center
+    bool valid = false;      // false for entities without vertices; they are never culled
+};
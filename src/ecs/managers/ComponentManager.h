@@ -36,7 +36,7 @@ public:
         assert(!entityToComponentMapping[entity] && "Component already exists for entity.");
 
         // Assign the component to the entity
-        componentStorage[entity] = component;
+        componentStorage[entity] = std::move(component);
         // Mark that this entity now has this component type
         entityToComponentMapping[entity] = true;
         ++componentCount;
@@ -109,7 +109,7 @@ public:
     void AddComponent(Entity entity, T component)
     {
         std::lock_guard<std::mutex> lock(mutex);
-        GetComponentArray<T>()->AddComponent(entity, component);
+        GetComponentArray<T>()->AddComponent(entity, std::move(component));
         entitiesByComponentType[std::type_index(typeid(T))].insert(entity);
         validEntities.insert(entity);
     }
@@ -0,0 +1,68 @@
+#pragma once
+#include "System.h"
+#include <vector>
+#include "ComponentManager.h"
+#include "SceneContext.h"
+#include "WorldBoundsComponent.h"
+#include "RenderQueue.h"
+#include "FrustumCuller.h"
+
+/**
+ * CullingSystem runs between RenderPreprocessorSystem and RenderSystem and
+ * drops the queued draws whose WorldBoundsComponent lies outside the view
+ * frustum, before the queue is sorted. Draws without valid bounds are kept.
+ */
+class CullingSystem : public System
+{
+public:
+    CullingSystem(ComponentManager &componentManager, SceneContext &sceneContext, RenderQueue &renderQueue);
+
+    void Update(float deltaTime) override;
+
+private:
+    ComponentManager &componentManager;
+    SceneContext &sceneContext;
+    RenderQueue &renderQueue;
+    FrustumCuller culler;
+
+    std::vector<size_t> tested; // queue index of each volume given to the culler
+    std::vector<uint8_t> inside;
+    std::vector<uint8_t> keep;
+};
+
+CullingSystem::CullingSystem(ComponentManager &componentManager, SceneContext &sceneContext, RenderQueue &renderQueue)
+    : componentManager(componentManager), sceneContext(sceneContext), renderQueue(renderQueue)
+{
+}
+
+void CullingSystem::Update(float deltaTime)
+{
+    const std::vector<DrawItem> &items = renderQueue.Items();
+
+    // the same matrices the Scene uniform block is filled from
+    culler.SetFrustum(sceneContext.getPerspectiveProjectionMatrix(sceneContext.windowWidth, sceneContext.windowHeight) * sceneContext.viewMatrix);
+    culler.Clear();
+    tested.clear();
+    keep.assign(items.size(), 1);
+
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        Entity entity = items[i].entity;
+        if (!componentManager.HasComponent<WorldBoundsComponent>(entity))
+            continue;
+        const WorldBoundsComponent &bounds = componentManager.GetComponent<WorldBoundsComponent>(entity);
+        if (!bounds.valid)
+            continue;
+        culler.Add(bounds.center, bounds.extents, bounds.radius);
+        tested.push_back(i);
+    }
+
+    size_t visible = items.size() - tested.size() + culler.Test(inside);
+    for (size_t i = 0; i < tested.size(); ++i)
+        keep[tested[i]] = inside[i];
+
+    size_t culled = items.size() - visible;
+    if (culled > 0)
+        renderQueue.Retain(keep);
+    renderQueue.RecordCulling(visible, culled);
+}
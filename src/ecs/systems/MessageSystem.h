@@ -9,8 +9,12 @@
 #include "EventBus.h"
 #include "IdComponent.h"
 #include "EntityCreationMessageV2.h"
+#include "EntityUpdateMessage.h"
+#include "MessageCoalescer.h"
 #include "ShaderComponent.h"
 #include "ThreeDComponent.h"
+#include "GeometryCache.h"
+#include "RenderComponent.h"
 
 class MessageSystem : public System
 {
@@ -19,78 +23,170 @@ public:
     ComponentManager &componentManager;
     QueueCollection &queueCollection;
     EventBus &eventBus;
+    GeometryCache &geometryCache;
+    GeometryArena &geometryArena;
 
     void Update(float deltaTime) override;
 
     std::unordered_map<int, Entity> idAssignmentMap;
+    MessageCoalescer coalescer;
 
     // MessageSystem(EntityManager &entityManager, ComponentManager &componentManager, QueueCollection &queueCollection, EventBus &eventBus)
     //     : entityManager(entityManager), componentManager(componentManager), queueCollection(queueCollection), eventBus(eventBus) {}
 
-    MessageSystem(EntityManager &entityManager, ComponentManager &componentManager, QueueCollection &queueCollection, EventBus &eventBus)
-        : entityManager(entityManager), componentManager(componentManager), queueCollection(queueCollection), eventBus(eventBus)
+    MessageSystem(EntityManager &entityManager, ComponentManager &componentManager, QueueCollection &queueCollection, EventBus &eventBus,
+                  GeometryCache &geometryCache, GeometryArena &geometryArena)
+        : entityManager(entityManager), componentManager(componentManager), queueCollection(queueCollection), eventBus(eventBus),
+          geometryCache(geometryCache), geometryArena(geometryArena), coalescer(queueCollection)
     {
     }
 
 private:
-    void ProcessCreationV2Messages()
+    // Apply the net operation per external id folded by the coalescer
+    void ProcessCoalescedMessages()
     {
-        std::vector<EntityCreationMessageV2> creationMessages;
-        while (queueCollection.entityCreationV2Queue.TryPop(creationMessages))
+        coalescer.Drain();
+
+        for (const auto &message : coalescer.Deletions())
         {
-            for (const auto &message : creationMessages)
-            {
-                auto it = idAssignmentMap.find(message.id);
+            destroyById(message.id);
+        }
 
-                // remaking the entity
-                if (it != idAssignmentMap.end())
-                {
-                    Entity entity = it->second;
-                    componentManager.RemoveAllComponents(entity);
-                    entityManager.DestroyEntity(entity);
-                    idAssignmentMap.erase(it);
-                }
+        for (auto &message : coalescer.Creations())
+        {
+            // remaking the entity
+            destroyById(message.id);
 
-                Entity newEntity = entityManager.CreateEntity();
-                componentManager.AddComponent(newEntity, IdComponent(message.id));
-                componentManager.AddComponent(newEntity, TransformComponent(message.transform.position[0],
-                                                                            message.transform.position[1],
-                                                                            message.transform.position[2],
-                                                                            message.transform.scale[0],
-                                                                            message.transform.scale[1],
-                                                                            message.transform.scale[2],
-                                                                            message.transform.rotation[0],
-                                                                            message.transform.rotation[1],
-                                                                            message.transform.rotation[2]));
-                std::vector<float> vertices = message.vertexData.positions;
-                std::vector<Vertex> shapeVertices;
-                for (size_t i = 0; i < vertices.size(); i += 3)
-                {
-                    shapeVertices.push_back(Vertex(vertices[i], vertices[i + 1], vertices[i + 2]));
-                }
+            Entity newEntity = entityManager.CreateEntity();
+            componentManager.AddComponent(newEntity, IdComponent(message.id));
+            componentManager.AddComponent(newEntity, TransformComponent(message.transform.position[0],
+                                                                        message.transform.position[1],
+                                                                        message.transform.position[2],
+                                                                        message.transform.scale[0],
+                                                                        message.transform.scale[1],
+                                                                        message.transform.scale[2],
+                                                                        message.transform.rotation[0],
+                                                                        message.transform.rotation[1],
+                                                                        message.transform.rotation[2]));
 
-                GeometryComponent shapeGeometry(shapeVertices);
-                componentManager.AddComponent(newEntity, shapeGeometry);
+            componentManager.AddComponent(newEntity, GeometryComponent());
+            takeMesh(componentManager.GetComponent<GeometryComponent>(newEntity), message.vertexData, message.mesh);
+            componentManager.AddComponent(newEntity, ShaderComponent(std::move(message.shaders.vertexShader),
+                                                                     std::move(message.shaders.fragmentShader)));
 
-                ShaderComponent shaderComponent(message.shaders.vertexShader, message.shaders.fragmentShader);
-                componentManager.AddComponent(newEntity, shaderComponent);
+            const std::vector<float> &color = message.uniforms.floatVecUniforms.at("color");
+            componentManager.AddComponent(newEntity, ColorComponent(color[0], color[1], color[2]));
 
-                ColorComponent colorComponent(message.uniforms.floatVecUniforms.at("color")[0],
-                                              message.uniforms.floatVecUniforms.at("color")[1],
-                                              message.uniforms.floatVecUniforms.at("color")[2]);
+            ReleaseVertexData(queueCollection.floatBufferPool, message.vertexData);
 
-                componentManager.AddComponent(newEntity, colorComponent);
+            idAssignmentMap[message.id] = newEntity;
 
-                idAssignmentMap[message.id] = newEntity;
+            // TODO: decide if this makes sense
+            entityManager.PublishEntityCreation(newEntity);
+        }
+
+        for (auto &message : coalescer.Updates())
+        {
+            auto it = idAssignmentMap.find(message.id);
+            if (it != idAssignmentMap.end())
+            {
+                applyUpdate(it->second, message);
+            }
+            ReleaseVertexData(queueCollection.floatBufferPool, message.vertexData);
+        }
+    }
 
-                // TODO: decide if this makes sense
-                entityManager.PublishEntityCreation(newEntity);
+    void destroyById(int id)
+    {
+        auto it = idAssignmentMap.find(id);
+        if (it != idAssignmentMap.end())
+        {
+            Entity entity = it->second;
+            if (componentManager.HasComponent<GeometryComponent>(entity))
+            {
+                releaseMesh(componentManager.GetComponent<GeometryComponent>(entity));
             }
+            if (componentManager.HasComponent<RenderComponent>(entity) &&
+                componentManager.GetComponent<RenderComponent>(entity).ownsRange)
+            {
+                geometryArena.Free(componentManager.GetComponent<RenderComponent>(entity).arenaRange);
+            }
+            componentManager.RemoveAllComponents(entity);
+            entityManager.DestroyEntity(entity);
+            idAssignmentMap.erase(it);
+        }
+    }
+
+    // Patch the components named in the update in place; the render preprocessor
+    // picks the changes up through the dirty flags and keeps the existing VAO/VBO
+    void applyUpdate(Entity entity, EntityUpdateMessage &message)
+    {
+        if (message.fields & UPDATE_TRANSFORM && componentManager.HasComponent<TransformComponent>(entity))
+        {
+            auto &transform = componentManager.GetComponent<TransformComponent>(entity);
+            const auto &source = message.transform;
+            if (message.Has(UPDATE_POSITION))
+                transform.position = glm::vec3(source.position[0], source.position[1], source.position[2]);
+            if (message.Has(UPDATE_ROTATION))
+                transform.rotation = glm::vec3(source.rotation[0], source.rotation[1], source.rotation[2]);
+            if (message.Has(UPDATE_SCALE))
+                transform.scale = glm::vec3(source.scale[0], source.scale[1], source.scale[2]);
+            transform.dirty = true;
+        }
+
+        if (message.Has(UPDATE_COLOR) && componentManager.HasComponent<ColorComponent>(entity))
+        {
+            const std::vector<float> &color = message.uniforms.floatVecUniforms.at("color");
+            auto &colorComponent = componentManager.GetComponent<ColorComponent>(entity);
+            colorComponent.r = color[0];
+            colorComponent.g = color[1];
+            colorComponent.b = color[2];
+            colorComponent.SetTargetColor(color[0], color[1], color[2]);
+            colorComponent.dirty = true;
+        }
+
+        if (message.Has(UPDATE_GEOMETRY) && componentManager.HasComponent<GeometryComponent>(entity))
+        {
+            takeMesh(componentManager.GetComponent<GeometryComponent>(entity), message.vertexData, message.mesh);
+        }
+    }
+
+    // Points the component at the cached copy of the mesh prepared by the
+    // MeshPipeline; meshes that bypassed the pipeline are interleaved here instead
+    void takeMesh(GeometryComponent &geometry, const VertexData &vertexData, PreparedMesh &mesh)
+    {
+        if (!mesh.ready)
+        {
+            PrepareMesh(vertexData.positions, vertexData.texCoords, vertexData.normals, vertexData.colors, vertexData.indices,
+                        vertexData.positionFormat, mesh);
+            queueCollection.ingestStats.verticesIngested += mesh.vertexCount;
+            queueCollection.ingestStats.RecordCopy(mesh.vertices.size());
+            queueCollection.ingestStats.RecordIndexing(!mesh.indices.empty(), mesh.weldedVertices, mesh.NonIndexedBytes(), mesh.Bytes());
+            queueCollection.ingestStats.RecordVertexFormat(VertexFormat::Get(mesh.format).IsCompact(), mesh.vertices.size(), mesh.FloatVertexBytes());
+        }
+        geometry.boundsMin = mesh.boundsMin;
+        geometry.boundsMax = mesh.boundsMax;
+        geometry.hasBounds = true;
+
+        // acquire before releasing so an unchanged mesh is never evicted in between
+        uint64_t previous = geometry.meshKey;
+        geometry.meshKey = geometryCache.Acquire(std::move(mesh));
+        if (previous != 0)
+        {
+            geometryCache.Release(previous);
         }
+        geometry.vertices.clear();
+        geometry.indices.clear();
+        geometry.dirty = true;
     }
 
-    void ProcessDeletionV2Messages()
+    void releaseMesh(GeometryComponent &geometry)
     {
+        if (geometry.meshKey != 0)
+        {
+            geometryCache.Release(geometry.meshKey);
+            geometry.meshKey = 0;
+        }
     }
 
     void ProcessCreationMessages()
@@ -183,25 +279,6 @@ private:
         }
     }
 
-    void ProcessDeletionMessages()
-    {
-        std::vector<EntityDeletionMessage> deletionMessages;
-        while (queueCollection.entityDeletionQueue.TryPop(deletionMessages))
-        {
-            for (const auto &message : deletionMessages)
-            {
-                auto it = idAssignmentMap.find(message.id);
-                if (it != idAssignmentMap.end())
-                {
-                    Entity entity = it->second;
-                    componentManager.RemoveAllComponents(entity);
-                    entityManager.DestroyEntity(entity);
-                    idAssignmentMap.erase(it);
-                }
-            }
-        }
-    }
-
     void ProcessColorChangeMessages()
     {
         std::tuple<float, float, float> color;
@@ -228,8 +305,11 @@ private:
         for (auto entity : colorEntities)
         {
             auto &colorComponent = componentManager.GetComponent<ColorComponent>(entity);
-            colorComponent.UpdateColor(); // Gradually update color towards target
-            colorComponent.dirty = true;
+            // Gradually update color towards target, re-uploading only while it moves
+            if (colorComponent.UpdateColor())
+            {
+                colorComponent.dirty = true;
+            }
         }
     }
 };
@@ -237,8 +317,8 @@ private:
     void MessageSystem::Update(float deltaTime)
     {
         ProcessCreationMessages();
-        ProcessCreationV2Messages();
-        ProcessDeletionV2Messages();
-        ProcessDeletionMessages();
+        ProcessCoalescedMessages();
         ProcessColorChangeMessages();
+
+        queueCollection.ingestStats.MarkDrained();
     }
\ No newline at end of file
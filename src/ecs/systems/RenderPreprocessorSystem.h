@@ -6,12 +6,17 @@
 #include "SceneMetaChangeEvent.h"
 #include "EntityUpdatedEvent.h"
 #include "TextBlockComponent.h"
+#include "GeometryCache.h"
+#include "RenderQueue.h"
+#include "StreamBuffer.h"
+#include "WorldBoundsComponent.h"
 
 class RenderPreprocessorSystem : public System
 {
 public:
     // RenderPreprocessorSystem(EventBus &eventBus, ComponentManager &componentManager, UniformManager &uniformManager);
-    RenderPreprocessorSystem(ComponentManager &componentManager, UniformManager &uniformManager);
+    RenderPreprocessorSystem(ComponentManager &componentManager, UniformManager &uniformManager, GeometryCache &geometryCache,
+                             GeometryArena &geometryArena, StreamBuffer &streamBuffer, ShaderManager &shaderManager, RenderQueue &renderQueue);
 
     void setupVisibility(Entity entity);
     void Update(float deltaTime) override;
@@ -20,15 +25,27 @@ private:
     UniformManager &uniformManager;
     // EventBus &eventBus;
     ComponentManager &componentManager;
-
+    GeometryCache &geometryCache;
+    GeometryArena &geometryArena;
+    StreamBuffer &streamBuffer; // stages rebuilt geometry on its way into the arena
+    std::vector<unsigned char> packedIndices;
+    ShaderManager &shaderManager;
+    RenderQueue &renderQueue;
+
+    void useCachedGeometry(Entity entity, const GeometryComponent &geometry);
+    void enqueue(Entity entity, const glm::mat4 &view);
+    void updateBounds(Entity entity);
     void updateEntity(Entity entity);
     void updateEntityColor(Entity entity);
+    const PositionDecode &positionDecode(Entity entity);
 };
 
 // RenderPreprocessorSystem::RenderPreprocessorSystem(EventBus &eventBus, ComponentManager &componentManager, UniformManager &uniformManager)
 //     : eventBus(eventBus), componentManager(componentManager), uniformManager(uniformManager)
-RenderPreprocessorSystem::RenderPreprocessorSystem(ComponentManager &componentManager, UniformManager &uniformManager)
-    : componentManager(componentManager), uniformManager(uniformManager)
+RenderPreprocessorSystem::RenderPreprocessorSystem(ComponentManager &componentManager, UniformManager &uniformManager, GeometryCache &geometryCache,
+                                                   GeometryArena &geometryArena, StreamBuffer &streamBuffer, ShaderManager &shaderManager, RenderQueue &renderQueue)
+    : componentManager(componentManager), uniformManager(uniformManager), geometryCache(geometryCache), geometryArena(geometryArena),
+      streamBuffer(streamBuffer), shaderManager(shaderManager), renderQueue(renderQueue)
 {
     // this->eventBus.subscribe<EntityCreatedEvent>([this](const EntityCreatedEvent &event)
     //                                              { this->AddEntity(event.entity); });
@@ -47,76 +64,66 @@ void RenderPreprocessorSystem::setupVisibility(Entity entity)
 {
     // System::AddEntity(entity);
 
-    if (!this->componentManager.HasComponent<RenderComponent>(entity))
+    if (this->componentManager.HasComponent<GeometryComponent>(entity) &&
+        this->componentManager.GetComponent<GeometryComponent>(entity).meshKey != 0)
     {
-        unsigned int VAO, VBO;
-        glGenVertexArrays(1, &VAO);
-        glBindVertexArray(VAO);
-        glGenBuffers(1, &VBO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-        GLsizei numVertices = 0;
-        GLsizeiptr bufferSize = 0;
-
-        if (this->componentManager.HasComponent<GeometryComponent>(entity))
-        {
-            auto &geometry = this->componentManager.GetComponent<GeometryComponent>(entity);
-            numVertices = geometry.vertices.size();
-            bufferSize = numVertices * sizeof(Vertex);
-            glBufferData(GL_ARRAY_BUFFER, bufferSize, geometry.vertices.data(), GL_STATIC_DRAW);
-        }
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, x)); // Position
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, u)); // Texture coordinates
-        glEnableVertexAttribArray(1);
-
-        auto renderComponent = RenderComponent(VAO, VBO, numVertices, bufferSize);
+        useCachedGeometry(entity, this->componentManager.GetComponent<GeometryComponent>(entity));
+    }
+    else if (!this->componentManager.HasComponent<RenderComponent>(entity))
+    {
+        // geometry not shared through the cache gets a range of its own
+        static const GeometryComponent noGeometry;
+        const GeometryComponent &geometry = this->componentManager.HasComponent<GeometryComponent>(entity)
+                                                ? this->componentManager.GetComponent<GeometryComponent>(entity)
+                                                : noGeometry;
+        const std::vector<Vertex> &vertices = geometry.vertices;
+        uint32_t range = geometryArena.Allocate(vertices, geometry.indices);
+
+        auto renderComponent = RenderComponent(geometryArena.VAO(range), 0, vertices.size(), vertices.size() * sizeof(Vertex));
+        renderComponent.arenaRange = range;
+        renderComponent.ownsRange = true;
         this->componentManager.AddComponent(entity, renderComponent);
     }
 
-    auto [lightPos, lightColor] = this->uniformManager.GetSceneContext().getLightProperties();
-    uniformManager.StoreEntityUniforms(entity, "lightPos", std::vector<float>{lightPos[0], lightPos[1], lightPos[2]});
-    uniformManager.StoreEntityUniforms(entity, "lightColor", std::vector<float>{lightColor[0], lightColor[1], lightColor[2]});
-
+    // view, projection and light come from the Scene uniform block; only per-object uniforms are stored
     if (componentManager.HasComponent<ColorComponent>(entity))
     {
         auto &colorComponent = componentManager.GetComponent<ColorComponent>(entity);
-        auto color = std::vector<float>{colorComponent.r, colorComponent.g, colorComponent.b, 1.0f};
-        uniformManager.StoreEntityUniforms(entity, "ourColor", color);
+        uniformManager.SetColor(entity, glm::vec4(colorComponent.r, colorComponent.g, colorComponent.b, 1.0f));
     }
 
-    glm::mat4 view = this->uniformManager.GetSceneContext().viewMatrix;
-    uniformManager.StoreEntityUniforms(entity, "view", view);
-
-    glm::mat4 projection = this->uniformManager.GetSceneContext().getPerspectiveProjectionMatrix();
-    uniformManager.StoreEntityUniforms(entity, "projection", projection);
-
     if (componentManager.HasComponent<TransformComponent>(entity))
     {
         TransformComponent &transform = componentManager.GetComponent<TransformComponent>(entity);
-        glm::mat4 modelMatrix = transform.GetModelMatrix();
-        uniformManager.StoreEntityUniforms(entity, "model", modelMatrix);
+        glm::mat4 modelMatrix = transform.GetModelMatrix() * positionDecode(entity).Matrix();
+        uniformManager.SetModel(entity, modelMatrix);
     }
 
     if (componentManager.HasComponent<TextureComponent>(entity))
     {
-        TextureComponent textureComponent = componentManager.GetComponent<TextureComponent>(entity);
-        uniformManager.StoreEntityUniforms(entity, "textureID", textureComponent.textureIDs);
+        TextureComponent &textureComponent = componentManager.GetComponent<TextureComponent>(entity);
+        uniformManager.SetCustom(entity, "textureID", textureComponent.textureIDs);
     }
 
     // TODO: getting too detailed here. Maybe change to a plugin system
     if (componentManager.HasComponent<TextBlockComponent>(entity))
     {
-        auto text = componentManager.GetComponent<TextBlockComponent>(entity);
-        uniformManager.StoreEntityUniforms(entity, "textTexture", text.texture);
-        uniformManager.StoreEntityUniforms(entity, "ourColor", text.color);
+        auto &text = componentManager.GetComponent<TextBlockComponent>(entity);
+        uniformManager.SetCustom(entity, "textTexture", {text.texture});
+        if (text.color.size() == 4)
+        {
+            uniformManager.SetColor(entity, glm::vec4(text.color[0], text.color[1], text.color[2], text.color[3]));
+        }
     }
 }
 
 void RenderPreprocessorSystem::Update(float deltaTime)
 {
+    // ranges only move here, before this frame's draws record where they start
+    geometryArena.DefragmentIfNeeded();
+    renderQueue.Clear();
+    glm::mat4 view = uniformManager.GetSceneContext().viewMatrix;
+
     // for (auto entity : this->entities)
     for (auto entity : componentManager.GetEntitiesWithComponent<GeometryComponent>())
     {
@@ -133,14 +140,28 @@ void RenderPreprocessorSystem::Update(float deltaTime)
             setupVisibility(entity);
         }
 
+        // resolve the program once per attached ShaderComponent, so drawing never touches shader files
+        if (componentManager.HasComponent<ShaderComponent>(entity))
+        {
+            auto &shader = componentManager.GetComponent<ShaderComponent>(entity);
+            if (shader.programSlot == 0)
+            {
+                shader.programSlot = shaderManager.ResolveProgram(shader.vertexShader, shader.fragmentShader);
+            }
+        }
+
         if (componentManager.HasComponent<ColorComponent>(entity) && componentManager.GetComponent<ColorComponent>(entity).dirty)
         {
             updateEntityColor(entity);
         }
 
+        // world bounds follow the model matrix and the vertices, so only a change to either moves them
+        bool boundsDirty = !componentManager.HasComponent<WorldBoundsComponent>(entity);
+
         if (componentManager.GetComponent<TransformComponent>(entity).dirty)
         {
             updateEntity(entity);
+            boundsDirty = true;
         }
 
         if (componentManager.HasComponent<GeometryComponent>(entity) && componentManager.HasComponent<RenderComponent>(entity))
@@ -148,27 +169,133 @@ void RenderPreprocessorSystem::Update(float deltaTime)
             auto &geometry = componentManager.GetComponent<GeometryComponent>(entity);
             auto &render = componentManager.GetComponent<RenderComponent>(entity);
 
-            if (geometry.dirty)
+            if (geometry.dirty && geometry.meshKey != 0)
             {
-                glBindVertexArray(render.VAO);
-                glBindBuffer(GL_ARRAY_BUFFER, render.VBO);
-
-                if (geometry.vertices.size() * sizeof(Vertex) > render.bufferSize)
-                {
-                    glBufferData(GL_ARRAY_BUFFER, geometry.vertices.size() * sizeof(Vertex), geometry.vertices.data(), GL_STATIC_DRAW);
-                    render.bufferSize = geometry.vertices.size() * sizeof(Vertex);
-                }
-                else
+                useCachedGeometry(entity, geometry);
+                // the new mesh may decode its positions differently
+                updateEntity(entity);
+                geometry.dirty = false;
+                boundsDirty = true;
+            }
+            else if (geometry.dirty && render.ownsRange)
+            {
+                // streamed and copied on the GPU, so draws still reading the range are not waited on
+                GLintptr vertexOffset = streamBuffer.Write(geometry.vertices.data(), geometry.vertices.size() * sizeof(Vertex));
+                GLintptr indexOffset = 0;
+                if (!geometry.indices.empty())
                 {
-                    glBufferSubData(GL_ARRAY_BUFFER, 0, geometry.vertices.size() * sizeof(Vertex), geometry.vertices.data());
+                    GeometryArena::PackIndices(geometry.indices, geometry.vertices.size(), packedIndices);
+                    indexOffset = streamBuffer.Write(packedIndices.data(), packedIndices.size());
                 }
-
+                geometryArena.CopyFrom(render.arenaRange, streamBuffer.Buffer(), vertexOffset, geometry.vertices.size(),
+                                       indexOffset, geometry.indices.size());
                 render.vertexCount = geometry.vertices.size();
+                render.bufferSize = geometry.vertices.size() * sizeof(Vertex);
+                geometry.ComputeBounds();
                 geometry.dirty = false;
-
-                glBindVertexArray(0);
+                boundsDirty = true;
             }
         }
+
+        if (boundsDirty)
+        {
+            updateBounds(entity);
+        }
+        enqueue(entity, view);
+    }
+}
+
+// Emits the draw for an entity that has everything RenderSystem needs
+void RenderPreprocessorSystem::enqueue(Entity entity, const glm::mat4 &view)
+{
+    if (!componentManager.HasComponent<RenderComponent>(entity) || !componentManager.HasComponent<ShaderComponent>(entity))
+        return;
+    uint32_t programSlot = componentManager.GetComponent<ShaderComponent>(entity).programSlot;
+    if (programSlot == 0)
+        return;
+
+    const RenderComponent &render = componentManager.GetComponent<RenderComponent>(entity);
+    const EntityUniforms &uniforms = uniformManager.Get(entity);
+
+    GLuint texture = 0;
+    bool textured = componentManager.HasComponent<TextureComponent>(entity);
+    if (textured && !componentManager.GetComponent<TextureComponent>(entity).textureIDs.empty())
+        texture = componentManager.GetComponent<TextureComponent>(entity).textureIDs[0];
+
+    bool transparent = textured || (uniforms.Has(UNIFORM_COLOR) && uniforms.color.a < 1.0f);
+    RenderPass pass = componentManager.HasComponent<TextBlockComponent>(entity) ? RENDER_PASS_OVERLAY : RENDER_PASS_SCENE;
+    // distance along the view direction of the entity's origin
+    float depth = -(view * uniforms.model[3]).z;
+
+    DrawItem item;
+    item.key = RenderQueue::MakeKey(pass, transparent, programSlot, texture, render.arenaRange, depth);
+    item.entity = entity;
+    item.programSlot = programSlot;
+    item.VAO = render.VAO;
+    item.firstVertex = render.arenaRange != 0 ? geometryArena.First(render.arenaRange) : 0;
+    item.texture = texture;
+    item.vertexCount = render.vertexCount;
+    item.indexCount = render.arenaRange != 0 ? geometryArena.IndexCount(render.arenaRange) : 0;
+    item.indexType = render.arenaRange != 0 ? geometryArena.IndexTypeOf(render.arenaRange) : GL_UNSIGNED_SHORT;
+    item.indexOffset = render.arenaRange != 0 ? geometryArena.IndexOffset(render.arenaRange) : 0;
+    item.transparent = transparent;
+    renderQueue.Push(item);
+}
+
+// Transforms the object space box of the entity's geometry into world space:
+// the box around the transformed box (Arvo), and the sphere around the
+// object box scaled by the largest axis scale
+void RenderPreprocessorSystem::updateBounds(Entity entity)
+{
+    if (!componentManager.HasComponent<WorldBoundsComponent>(entity))
+    {
+        componentManager.AddComponent(entity, WorldBoundsComponent{});
+    }
+    WorldBoundsComponent &bounds = componentManager.GetComponent<WorldBoundsComponent>(entity);
+
+    GeometryComponent &geometry = componentManager.GetComponent<GeometryComponent>(entity);
+    if (!geometry.hasBounds && geometry.meshKey == 0)
+    {
+        geometry.ComputeBounds();
+    }
+    bounds.valid = geometry.hasBounds;
+    if (!bounds.valid)
+        return;
+
+    // the model matrix decodes the stored positions; the bounds are of the decoded ones
+    const PositionDecode &decode = positionDecode(entity);
+    glm::mat4 model = uniformManager.Get(entity).model;
+    if (!decode.IsIdentity())
+        model = model * decode.Inverse();
+    glm::vec3 center = (geometry.boundsMin + geometry.boundsMax) * 0.5f;
+    glm::vec3 extents = (geometry.boundsMax - geometry.boundsMin) * 0.5f;
+
+    bounds.center = glm::vec3(model * glm::vec4(center, 1.0f));
+    bounds.extents = glm::abs(glm::vec3(model[0])) * extents.x +
+                     glm::abs(glm::vec3(model[1])) * extents.y +
+                     glm::abs(glm::vec3(model[2])) * extents.z;
+    float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    bounds.radius = glm::length(extents) * scale;
+}
+
+// Points the entity's RenderComponent at the arena range shared through the GeometryCache
+void RenderPreprocessorSystem::useCachedGeometry(Entity entity, const GeometryComponent &geometry)
+{
+    const CachedGeometry &cached = geometryCache.Upload(geometry.meshKey);
+    auto renderComponent = RenderComponent(geometryArena.VAO(cached.range), 0, cached.vertexCount, cached.Bytes());
+    renderComponent.arenaRange = cached.range;
+    renderComponent.decode = cached.decode;
+
+    if (componentManager.HasComponent<RenderComponent>(entity))
+    {
+        RenderComponent &previous = componentManager.GetComponent<RenderComponent>(entity);
+        if (previous.ownsRange)
+            geometryArena.Free(previous.arenaRange);
+        previous = renderComponent;
+    }
+    else
+    {
+        componentManager.AddComponent(entity, renderComponent);
     }
 }
 
@@ -182,19 +309,27 @@ void RenderPreprocessorSystem::updateEntity(Entity entity)
 
     TransformComponent &transform = componentManager.GetComponent<TransformComponent>(entity);
 
-    glm::mat4 modelMatrix = transform.GetModelMatrix();
-    uniformManager.StoreEntityUniforms(entity, "model", modelMatrix);
+    glm::mat4 modelMatrix = transform.GetModelMatrix() * positionDecode(entity).Matrix();
+    uniformManager.SetModel(entity, modelMatrix);
 
     transform.dirty = false;
 }
 
+// Decode of the positions the entity's range stores; identity for plain float vertices
+const PositionDecode &RenderPreprocessorSystem::positionDecode(Entity entity)
+{
+    static const PositionDecode identity;
+    if (!componentManager.HasComponent<RenderComponent>(entity))
+        return identity;
+    return componentManager.GetComponent<RenderComponent>(entity).decode;
+}
+
 void RenderPreprocessorSystem::updateEntityColor(Entity entity)
 {
     if (componentManager.HasComponent<ColorComponent>(entity))
     {
         auto &colorComponent = componentManager.GetComponent<ColorComponent>(entity);
-        auto color = std::vector<float>{colorComponent.r, colorComponent.g, colorComponent.b, 1.0f};
-        uniformManager.StoreEntityUniforms(entity, "ourColor", color);
+        uniformManager.SetColor(entity, glm::vec4(colorComponent.r, colorComponent.g, colorComponent.b, 1.0f));
         colorComponent.dirty = false;
     }
 }
\ No newline at end of file
@@ -14,8 +14,12 @@
 #include "ShaderComponent.h"
 #include <glfw3.h>
 #include "SceneContext.h"
-#include "UniformData.h"
 #include "UniformManager.h"
+#include "SceneUniformBuffer.h"
+#include "RenderQueue.h"
+#include "InstanceBuffer.h"
+#include "IndirectDrawBuffer.h"
+#include <array>
 #include "TextureComponent.h"
 
 void CheckGLError()
@@ -51,21 +55,64 @@ class RenderSystem : public System
 {
 public:
     // RenderSystem(EventBus &eventBus, SceneContext &context, UniformManager &uniformManager);
-    RenderSystem(SceneContext &context, UniformManager &uniformManager);
+    RenderSystem(SceneContext &context, UniformManager &uniformManager, ShaderManager &shaderManager, RenderQueue &renderQueue,
+                 StreamBuffer &streamBuffer);
     void Update(float dt, ComponentManager &componentManager);
     void UpdateV2(float dt, ComponentManager &componentManager);
     void UpdateV3(float dt, ComponentManager &componentManager);
     void UpdateV4(float dt, ComponentManager &componentManager);
 
-    void Initialize();
+    // Loads the multi-draw indirect entry points. When the driver has them the
+    // opaque items of programs with an instanced variant are drawn from
+    // indirect commands, one submission per program and VAO; otherwise runs of
+    // the same mesh become instanced batches. Needs a current context
+    void Initialize(GLADloadproc getProcAddress);
     // void RemoveEntity(Entity entity);
 
 private:
     // EventBus &eventBus;
     SceneContext &sceneContext; // Reference to the shared context
 
-    ShaderManager shaderManager;
+    ShaderManager &shaderManager;
     UniformManager &uniformManager;
+    SceneUniformBuffer sceneUniforms; // view, projection and light, shared by every program
+    RenderQueue &renderQueue;
+    StreamBuffer &streamBuffer;
+    InstanceBuffer instanceBuffer;
+    IndirectDrawBuffer indirectDraws;
+    bool indirectDrawing = false; // multi-draw indirect is available
+
+    // Consecutive queue items drawn together: one instanced draw when
+    // instancedSlot is set, commandCount indirect commands from firstCommand
+    // when indirect, otherwise one draw per item
+    struct DrawBatch
+    {
+        size_t first;
+        size_t count;
+        uint32_t instancedSlot;
+        size_t firstInstance;
+        bool indirect = false;
+        size_t firstCommand = 0;
+        size_t commandCount = 0;
+    };
+    // runs of the same mesh and program shorter than this are drawn one by one
+    static constexpr size_t MIN_INSTANCES = 4;
+
+    std::vector<DrawBatch> batches;
+    std::vector<InstanceData> instances;
+
+    // GL state left bound by the previous draw of the frame
+    struct BoundState
+    {
+        GLuint program = 0;
+        GLuint VAO = 0;
+        std::array<GLuint, 8> textures{};
+        int blend = -1; // unknown until the first draw sets it
+        bool samplersSet = false;
+        ObjectUniformLocations locations;
+        uint64_t changes = 0;
+    };
+    BoundState bound;
 
     unsigned int shaderProgram;
 
@@ -74,12 +121,22 @@ private:
     // per entity helpers
     void setupGeometry(Entity entity, ComponentManager &componentManager);
     void setupShaderWithEntityData(TransformComponent &transform, float angle);
+    void applyUniforms(Entity entity, GLuint program, const ObjectUniformLocations &locations);
+    bool instanceable(const DrawItem &item);
+    void batchDraws();
+    size_t batchIndirectDraws(size_t first, uint32_t instancedSlot);
+    void bindProgram(GLuint program);
+    void bindVertexArray(GLuint VAO);
+    void setBlend(bool enabled);
+    void bindTextures(GLuint program, const std::vector<int> &textureIDs);
 };
 
 // RenderSystem::RenderSystem(EventBus &eventBus, SceneContext &context, UniformManager &uniformManager)
 //     : eventBus(eventBus), sceneContext(context), uniformManager(uniformManager)
-RenderSystem::RenderSystem(SceneContext &context, UniformManager &uniformManager)
-    : sceneContext(context), uniformManager(uniformManager)
+RenderSystem::RenderSystem(SceneContext &context, UniformManager &uniformManager, ShaderManager &shaderManager, RenderQueue &renderQueue,
+                           StreamBuffer &streamBuffer)
+    : sceneContext(context), shaderManager(shaderManager), uniformManager(uniformManager), renderQueue(renderQueue),
+      streamBuffer(streamBuffer), instanceBuffer(streamBuffer), indirectDraws(streamBuffer)
 {
     // this->eventBus.subscribe<EntityCreatedEvent>([this](const EntityCreatedEvent &event)
     //                                              { this->AddEntity(event.entity); });
@@ -124,84 +181,330 @@ void RenderSystem::initializeShaders()
     CheckGLError();
 }
 
-void RenderSystem::Initialize()
+void RenderSystem::Initialize(GLADloadproc getProcAddress)
 {
     initializeShaders();
+    sceneUniforms.Initialize();
+    indirectDrawing = indirectDraws.Initialize(getProcAddress);
     CheckGLError();
 
     glBindVertexArray(0);
 }
 
-void RenderSystem::UpdateV4(float dt, ComponentManager &componentManager)
+// Sets the per-object uniforms of an entity on the program in use
+void RenderSystem::applyUniforms(Entity entity, GLuint program, const ObjectUniformLocations &locations)
 {
-    // for (auto entity : this->entities)
-    for (auto entity : componentManager.GetEntitiesWithComponents<RenderComponent>())
-    {
-        if (!componentManager.HasComponent<ShaderComponent>(entity) ||
-            !componentManager.HasComponent<RenderComponent>(entity))
-            continue;
+    const EntityUniforms &uniforms = uniformManager.Get(entity);
+    if (uniforms.Has(UNIFORM_MODEL))
+        glUniformMatrix4fv(locations.model, 1, GL_FALSE, glm::value_ptr(uniforms.model));
+    if (uniforms.Has(UNIFORM_COLOR))
+        glUniform4fv(locations.color, 1, glm::value_ptr(uniforms.color));
 
-        RenderComponent renderComp = componentManager.GetComponent<RenderComponent>(entity);
-        ShaderComponent component = componentManager.GetComponent<ShaderComponent>(entity);
-        unsigned int program = shaderManager.LoadShaderProgram(
-            component.vertexShader,
-            component.fragmentShader);
-        CheckGLError();
+    if (std::vector<CustomUniform> *custom = uniformManager.Custom(entity))
+    {
+        for (CustomUniform &uniform : *custom)
+        {
+            if (uniform.program != program)
+            {
+                uniform.location = shaderManager.UniformLocation(program, uniform.name);
+                uniform.program = program;
+            }
+            if (uniform.location >= 0 && uniform.values.size() == 1)
+                glUniform1i(uniform.location, uniform.values[0]);
+        }
+    }
+}
 
-        shaderManager.UseShader(program);
+// True if the item may share an instanced or indirect draw. Those draws only
+// carry the model matrix and colour per instance and bind no textures, so
+// items with custom uniforms or a texture are drawn one by one; textured
+// entities are drawn as transparent today, the texture check keeps it so
+bool RenderSystem::instanceable(const DrawItem &item)
+{
+    return !item.transparent && item.texture == 0 && !uniformManager.Get(item.entity).Has(UNIFORM_CUSTOM);
+}
 
-        glBindVertexArray(renderComp.VAO);
+// Splits the sorted queue into batches, collecting the instance data of runs
+// of instanceable draws that share a mesh and a program with an instanced variant
+void RenderSystem::batchDraws()
+{
+    const std::vector<DrawItem> &items = renderQueue.Items();
+    batches.clear();
+    instances.clear();
+    indirectDraws.Clear();
 
-        // Bind textures if available
-        if (componentManager.HasComponent<TextureComponent>(entity))
+    for (size_t first = 0; first < items.size();)
+    {
+        const DrawItem &item = items[first];
+        bool batchable = instanceable(item);
+        if (indirectDrawing && batchable)
         {
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            if (uint32_t instancedSlot = shaderManager.InstancedVariant(item.programSlot))
+            {
+                first = batchIndirectDraws(first, instancedSlot);
+                continue;
+            }
+        }
 
-            TextureComponent &textureComp = componentManager.GetComponent<TextureComponent>(entity);
+        size_t end = first + 1;
+        if (batchable)
+        {
+            while (end < items.size() && instanceable(items[end]) && items[end].programSlot == item.programSlot &&
+                   items[end].VAO == item.VAO && items[end].firstVertex == item.firstVertex &&
+                   items[end].vertexCount == item.vertexCount && items[end].indexCount == item.indexCount &&
+                   items[end].indexOffset == item.indexOffset)
+                ++end;
+        }
 
-            // Bind multiple textures
-            for (unsigned int i = 0; i < textureComp.textureIDs.size(); ++i)
+        uint32_t instancedSlot = end - first >= MIN_INSTANCES ? shaderManager.InstancedVariant(item.programSlot) : 0;
+        batches.push_back(DrawBatch{first, end - first, instancedSlot, instances.size()});
+        if (instancedSlot != 0)
+        {
+            for (size_t i = first; i < end; ++i)
             {
-                glActiveTexture(GL_TEXTURE0 + i);
-                glBindTexture(GL_TEXTURE_2D, textureComp.textureIDs[i]);
+                const EntityUniforms &uniforms = uniformManager.Get(items[i].entity);
+                instances.push_back(InstanceData{uniforms.model, uniforms.Has(UNIFORM_COLOR) ? uniforms.color : glm::vec4(1.0f)});
+            }
+        }
+        first = end;
+    }
+}
+
+// Batches the run of instanceable items from first that share a program, VAO
+// and index type into indirect commands, one per run of the same
+// mesh, each starting at the instance data of its first item. Returns the end
+// of the run
+size_t RenderSystem::batchIndirectDraws(size_t first, uint32_t instancedSlot)
+{
+    const std::vector<DrawItem> &items = renderQueue.Items();
+    const DrawItem &item = items[first];
+    bool indexed = item.indexCount > 0;
+    size_t end = first + 1;
+    while (end < items.size() && instanceable(items[end]) && items[end].programSlot == item.programSlot &&
+           items[end].VAO == item.VAO && (items[end].indexCount > 0) == indexed &&
+           (!indexed || items[end].indexType == item.indexType))
+        ++end;
+
+    DrawBatch batch{first, end - first, instancedSlot, instances.size(), true};
+    batch.firstCommand = indexed ? indirectDraws.ElementsCommands().size() : indirectDraws.ArraysCommands().size();
+    size_t indexBytes = item.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    for (size_t i = first; i < end;)
+    {
+        const DrawItem &mesh = items[i];
+        size_t meshEnd = i + 1;
+        while (meshEnd < end && items[meshEnd].firstVertex == mesh.firstVertex && items[meshEnd].vertexCount == mesh.vertexCount &&
+               items[meshEnd].indexCount == mesh.indexCount && items[meshEnd].indexOffset == mesh.indexOffset)
+            ++meshEnd;
+
+        GLuint instanceCount = static_cast<GLuint>(meshEnd - i);
+        GLuint baseInstance = static_cast<GLuint>(batch.firstInstance + (i - first));
+        if (indexed)
+            indirectDraws.Add(DrawElementsIndirectCommand{static_cast<GLuint>(mesh.indexCount), instanceCount,
+                                                          static_cast<GLuint>(mesh.indexOffset / indexBytes), mesh.firstVertex, baseInstance});
+        else
+            indirectDraws.Add(DrawArraysIndirectCommand{static_cast<GLuint>(mesh.vertexCount), instanceCount,
+                                                        static_cast<GLuint>(mesh.firstVertex), baseInstance});
+        ++batch.commandCount;
+        i = meshEnd;
+    }
+
+    for (size_t i = first; i < end; ++i)
+    {
+        const EntityUniforms &uniforms = uniformManager.Get(items[i].entity);
+        instances.push_back(InstanceData{uniforms.model, uniforms.Has(UNIFORM_COLOR) ? uniforms.color : glm::vec4(1.0f)});
+    }
+    batches.push_back(batch);
+    return end;
+}
+
+void RenderSystem::bindProgram(GLuint program)
+{
+    if (program == bound.program)
+        return;
+    shaderManager.UseShader(program);
+    bound.locations = shaderManager.ObjectLocations(program);
+    bound.program = program;
+    bound.samplersSet = false;
+    ++bound.changes;
+}
+
+void RenderSystem::bindVertexArray(GLuint VAO)
+{
+    if (VAO == bound.VAO)
+        return;
+    glBindVertexArray(VAO);
+    bound.VAO = VAO;
+    ++bound.changes;
+}
+
+void RenderSystem::setBlend(bool enabled)
+{
+    if (bound.blend == static_cast<int>(enabled))
+        return;
+    enabled ? glEnable(GL_BLEND) : glDisable(GL_BLEND);
+    bound.blend = enabled;
+    ++bound.changes;
+}
+
+void RenderSystem::bindTextures(GLuint program, const std::vector<int> &textureIDs)
+{
+    for (unsigned int i = 0; i < textureIDs.size(); ++i)
+    {
+        if (i >= bound.textures.size() || bound.textures[i] != static_cast<GLuint>(textureIDs[i]))
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, textureIDs[i]);
+            if (i < bound.textures.size())
+                bound.textures[i] = textureIDs[i];
+            ++bound.changes;
+        }
+    }
 
-                // Set the sampler uniform to the corresponding texture unit
-                std::string uniformName = "textTexture" + std::to_string(i);
-                glUniform1i(glGetUniformLocation(program, uniformName.c_str()), i);
+    // Set the sampler uniforms to the corresponding texture units, once per bound program
+    if (!bound.samplersSet)
+    {
+        for (unsigned int i = 0; i < textureIDs.size(); ++i)
+        {
+            shaderManager.SetUniform1i(program, "textTexture" + std::to_string(i), i);
+        }
+        bound.samplersSet = true;
+    }
+}
+
+void RenderSystem::UpdateV4(float dt, ComponentManager &componentManager)
+{
+    // once per frame, instead of per draw
+    sceneUniforms.Update(sceneContext);
+
+    renderQueue.Sort();
+    batchDraws();
+    if (!instances.empty())
+    {
+        // the commands must land in the buffer the instance attributes point into
+        if (indirectDraws.Size() > 0)
+            streamBuffer.Reserve(instances.size() * sizeof(InstanceData) + StreamBuffer::ALIGNMENT + indirectDraws.Bytes());
+        instanceBuffer.Upload(instances);
+        indirectDraws.Upload();
+    }
+
+    bound = BoundState{};
+    uint64_t drawCalls = 0;
+    uint64_t instancedDraws = 0;
+    uint64_t multiDraws = 0;
+    uint64_t indexedDraws = 0;
+    uint64_t indices = 0;
+    uint64_t indexedVertices = 0;
+    uint64_t unsortedStateChanges = 0;
+    const std::vector<DrawItem> &items = renderQueue.Items();
+
+    for (const DrawBatch &batch : batches)
+    {
+        if (batch.indirect)
+        {
+            const DrawItem &item = items[batch.first];
+            bindProgram(shaderManager.Program(batch.instancedSlot));
+            setBlend(false);
+            bindVertexArray(item.VAO);
+            ++bound.changes;
+
+            bool indexed = item.indexCount > 0;
+            // baseInstance of each command selects its instance data
+            instanceBuffer.BindAttributes(0);
+            indexed ? indirectDraws.MultiDrawElements(item.indexType, batch.firstCommand, batch.commandCount)
+                    : indirectDraws.MultiDrawArrays(batch.firstCommand, batch.commandCount);
+            CheckGLError();
+            ++drawCalls;
+            ++multiDraws;
+            indexedDraws += indexed ? 1 : 0;
+
+            if (indexed)
+            {
+                for (size_t i = batch.first; i < batch.first + batch.count; ++i)
+                {
+                    indices += items[i].indexCount;
+                    indexedVertices += items[i].vertexCount;
+                }
             }
+            unsortedStateChanges += 2 * batch.count;
+            continue;
         }
 
-        // Set uniforms
-        UniformData uniforms = uniformManager.GetUniforms(entity);
-        for (auto &[key, val] : uniforms.floatVecUniforms)
+        if (batch.instancedSlot != 0)
         {
-            if (val.size() == 3)
+            const DrawItem &item = items[batch.first];
+            bindProgram(shaderManager.Program(batch.instancedSlot));
+            setBlend(false);
+            bindVertexArray(item.VAO);
+            // the instance range differs per batch, so the attributes are always re-pointed
+            instanceBuffer.BindAttributes(batch.firstInstance);
+            ++bound.changes;
+
+            if (item.indexCount > 0)
             {
-                shaderManager.SetUniform3f(program, key, val[0], val[1], val[2]);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.indexCount, item.indexType, reinterpret_cast<const void *>(item.indexOffset),
+                                                  batch.count, item.firstVertex);
+                ++indexedDraws;
+                indices += static_cast<uint64_t>(item.indexCount) * batch.count;
+                indexedVertices += static_cast<uint64_t>(item.vertexCount) * batch.count;
             }
-            else if (val.size() == 4)
+            else
             {
-                shaderManager.SetUniform4fv(program, key, glm::vec4(val[0], val[1], val[2], val[3]));
+                glDrawArraysInstanced(GL_TRIANGLES, item.firstVertex, item.vertexCount, batch.count);
             }
+            CheckGLError();
+            ++drawCalls;
+            ++instancedDraws;
+            unsortedStateChanges += 2 * batch.count;
+            continue;
         }
 
-        for (auto &[key, val] : uniforms.mat4Uniforms)
+        for (size_t i = batch.first; i < batch.first + batch.count; ++i)
         {
-            shaderManager.SetUniformMatrix4fv(program, key, glm::value_ptr(val));
-        }
+            const DrawItem &item = items[i];
+            GLuint program = shaderManager.Program(item.programSlot);
+            bindProgram(program);
+            bindVertexArray(item.VAO);
+            setBlend(item.transparent);
 
-        for (auto &[key, val] : uniforms.intUniforms)
-        {
-            if (val.size() == 1)
+            // every draw used to bind its program and VAO
+            unsortedStateChanges += 2;
+
+            // Bind textures if available
+            if (componentManager.HasComponent<TextureComponent>(item.entity))
             {
-                shaderManager.SetUniform1i(program, key, val[0]);
+                const std::vector<int> &textureIDs = componentManager.GetComponent<TextureComponent>(item.entity).textureIDs;
+                bindTextures(program, textureIDs);
+                // and enabled blending and bound every texture
+                unsortedStateChanges += 2 + textureIDs.size();
             }
-        }
 
-        glDrawArrays(GL_TRIANGLES, 0, renderComp.vertexCount);
-        CheckGLError();
+            applyUniforms(item.entity, program, bound.locations);
+
+            if (item.indexCount > 0)
+            {
+                glDrawElementsBaseVertex(GL_TRIANGLES, item.indexCount, item.indexType, reinterpret_cast<const void *>(item.indexOffset),
+                                         item.firstVertex);
+                ++indexedDraws;
+                indices += item.indexCount;
+                indexedVertices += item.vertexCount;
+            }
+            else
+            {
+                glDrawArrays(GL_TRIANGLES, item.firstVertex, item.vertexCount);
+            }
+            CheckGLError();
+            ++drawCalls;
+        }
     }
+
+    // blending stays enabled between frames, as set up by OpenGLApp::Run
+    if (bound.blend == 0)
+        glEnable(GL_BLEND);
+
+    renderQueue.RecordFrame(drawCalls, bound.changes, unsortedStateChanges);
+    renderQueue.RecordInstancing(instancedDraws, instances.size());
+    renderQueue.RecordIndexing(indexedDraws, indices, indexedVertices);
+    renderQueue.RecordIndirect(multiDraws, indirectDraws.Size());
 }
 
 void RenderSystem::UpdateV3(float dt, ComponentManager &componentManager)
@@ -221,26 +524,8 @@ void RenderSystem::UpdateV3(float dt, ComponentManager &componentManager)
 
         shaderManager.UseShader(program);
 
-        // get the uniforms from UniformComponent and set uniforms to shader
-
-        UniformData uniforms = uniformManager.GetUniforms(entity);
-
-        for (auto &[key, val] : uniforms.floatVecUniforms)
-        {
-            if (val.size() == 3)
-            {
-                shaderManager.SetUniform3f(program, key, val[0], val[1], val[2]);
-            }
-            else if (val.size() == 4)
-            {
-                shaderManager.SetUniform4fv(program, key, glm::vec4(val[0], val[1], val[2], val[3]));
-            }
-        }
-
-        for (auto &[key, val] : uniforms.mat4Uniforms)
-        {
-            shaderManager.SetUniformMatrix4fv(program, key, glm::value_ptr(val));
-        }
+        // get the uniforms from UniformManager and set uniforms to shader
+        applyUniforms(entity, program, shaderManager.ObjectLocations(program));
 
         // bind VAO from RenderComponent
 
@@ -116,6 +116,7 @@ void TextOverlaySystem::publishBlock(Entity entity)
     TransformComponent &transform = componentManager.GetComponent<TransformComponent>(entity);
 
     std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
     float cursorX = transform.position[0];
     float cursorY = transform.position[1];
     float z = transform.position[2];
@@ -167,13 +168,13 @@ void TextOverlaySystem::publishBlock(Entity entity)
             stbtt_GetBakedQuad(cdata, 1024, 1024, c - 32, &cursorX, &cursorY, &q, 1);
         }
 
-        // Correctly set up vertices and texture coordinates
+        // Correctly set up vertices and texture coordinates; the quad's two triangles share a diagonal
+        uint32_t corner = static_cast<uint32_t>(vertices.size());
         vertices.push_back(Vertex(q.x0 * renderScale, -q.y0 * renderScale, z, q.s0, q.t0));
         vertices.push_back(Vertex(q.x1 * renderScale, -q.y0 * renderScale, z, q.s1, q.t0));
         vertices.push_back(Vertex(q.x1 * renderScale, -q.y1 * renderScale, z, q.s1, q.t1));
-        vertices.push_back(Vertex(q.x0 * renderScale, -q.y0 * renderScale, z, q.s0, q.t0));
-        vertices.push_back(Vertex(q.x1 * renderScale, -q.y1 * renderScale, z, q.s1, q.t1));
         vertices.push_back(Vertex(q.x0 * renderScale, -q.y1 * renderScale, z, q.s0, q.t1));
+        indices.insert(indices.end(), {corner, corner + 1, corner + 2, corner, corner + 2, corner + 3});
 
         // Update bounding box dimensions based on the actual character positions
         if (q.x1 * renderScale > maxX)
@@ -191,7 +192,8 @@ void TextOverlaySystem::publishBlock(Entity entity)
 
     // Update the GeometryComponent with the new vertices
     GeometryComponent &geometry = componentManager.GetComponent<GeometryComponent>(entity);
-    geometry.vertices = vertices;
+    geometry.vertices = std::move(vertices);
+    geometry.indices = std::move(indices);
     geometry.dirty = true;
 
     // Calculate final height of the bounding box based on rendered text
@@ -0,0 +1,575 @@
+#pragma once
+#include <glad.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "Vertex.h"
+#include "VertexFormat.h"
+#include "IndexedGeometry.h"
+#include "IngestStats.h"
+
+/**
+ * GeometryArena keeps the vertices of every drawable mesh in one large VBO
+ * per VertexFormat, and the indices of indexed meshes in one large index
+ * buffer, with a VAO per format that has its VBO and the index buffer bound.
+ * Meshes hold a range handle, bind VAO(range) and are drawn with
+ * glDrawArrays(GL_TRIANGLES, First(range), Count(range)), or
+ * glDrawElementsBaseVertex with IndexCount(range) indices of
+ * IndexTypeOf(range) at IndexOffset(range) when IndexCount(range) is set, so
+ * switching between meshes of one format no longer means switching VAOs.
+ * Indices are stored relative to the first vertex of their range, in 16 bits
+ * when the range has at most 65536 vertices.
+ *
+ * Each buffer is handed out first fit from an offset-ordered free list whose
+ * neighbouring blocks are merged on release. When no block fits, the buffer
+ * grows by copying into one twice the size. When the free space is split
+ * into many small blocks, DefragmentIfNeeded packs the live ranges into a
+ * fresh buffer; handles stay valid but their offsets change, so it is
+ * called once per frame before draws are queued.
+ *
+ * The GL objects are created on first use, so the arena can be constructed
+ * before the context. Owned by the render thread.
+ */
+class GeometryArena
+{
+public:
+    GeometryArena(IngestStats &stats, size_t initialVertices = 1 << 16);
+    ~GeometryArena();
+
+    GeometryArena(const GeometryArena &) = delete;
+    GeometryArena &operator=(const GeometryArena &) = delete;
+
+    // Copies vertexCount vertices of format and their indices into the arena
+    // and returns a handle to them; never 0. Without indices the vertices are
+    // drawn as they are
+    uint32_t Allocate(const VertexFormat &format, const void *vertices, uint32_t vertexCount, const std::vector<uint32_t> &indices = {});
+    uint32_t Allocate(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices = {});
+    // Replaces the mesh of a range, in place when it fits and keeps its format
+    void Update(uint32_t range, const VertexFormat &format, const void *vertices, uint32_t vertexCount, const std::vector<uint32_t> &indices = {});
+    void Update(uint32_t range, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices = {});
+    // Replaces the mesh of a range with data copied on the GPU from another
+    // buffer, such as a StreamBuffer region: vertexCount vertices of the
+    // range's format at vertexOffset and indexCount indices packed by
+    // PackIndices at indexOffset
+    void CopyFrom(uint32_t range, GLuint source, GLintptr vertexOffset, uint32_t vertexCount,
+                  GLintptr indexOffset = 0, uint32_t indexCount = 0);
+    void Free(uint32_t range);
+
+    // Type the indices of a mesh with vertexCount vertices are stored as
+    static GLenum IndexType(size_t vertexCount)
+    {
+        return IndexBytes(vertexCount) == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+    // Narrows indices to IndexType(vertexCount)
+    static void PackIndices(const std::vector<uint32_t> &indices, size_t vertexCount, std::vector<unsigned char> &packed);
+
+    GLint First(uint32_t range) const { return static_cast<GLint>(ranges[range].vertices.first); }
+    GLsizei Count(uint32_t range) const { return static_cast<GLsizei>(ranges[range].vertices.count); }
+    // 0 for ranges drawn without indices
+    GLsizei IndexCount(uint32_t range) const { return static_cast<GLsizei>(ranges[range].indexCount); }
+    GLenum IndexTypeOf(uint32_t range) const { return ranges[range].indexType; }
+    GLintptr IndexOffset(uint32_t range) const { return static_cast<GLintptr>(ranges[range].indices.first) * indexPool.unitBytes; }
+    // VAO of the format the range is stored in
+    GLuint VAO(uint32_t range) const { return vertexPools[ranges[range].format].vao; }
+
+    // Packs the live ranges together when the free space is fragmented.
+    // Returns true if the ranges moved
+    bool DefragmentIfNeeded();
+
+private:
+    // Space taken by a range in one of the buffers, in units of the buffer
+    struct Block
+    {
+        uint32_t first = 0;
+        uint32_t capacity = 0; // units reserved, at least count
+        uint32_t count = 0;
+    };
+
+    struct Range
+    {
+        Block vertices; // in the pool of format
+        Block indices;  // in 4 byte words, two 16 bit indices to a word
+        uint32_t indexCount = 0;
+        GLenum indexType = GL_UNSIGNED_SHORT;
+        uint8_t format = 0;
+        bool live = false;
+    };
+
+    // One buffer and its free list; vertex pools also own the VAO of their format
+    struct Pool
+    {
+        size_t unitBytes = 0;
+        uint32_t capacity = 0; // in units
+        uint32_t used = 0;
+        GLuint buffer = 0;
+        GLuint vao = 0;
+        uint8_t format = 0;
+        std::map<uint32_t, uint32_t> freeBlocks{}; // first unit -> size
+    };
+
+    IngestStats &stats;
+    bool initialized = false;
+    std::array<Pool, VERTEX_FORMAT_COUNT> vertexPools; // by VertexFormat key, created on first use
+    Pool indexPool;
+
+    std::vector<Range> ranges{Range{}}; // handle 0 is "no range"
+    std::vector<uint32_t> freeHandles;
+    std::vector<unsigned char> packed; // scratch for PackIndices
+
+    void initialize();
+    Pool &vertexPool(uint8_t format);
+    bool reserve(Pool &pool, uint32_t count, uint32_t &first);
+    void release(Pool &pool, uint32_t first, uint32_t count);
+    void grow(Pool &pool, uint32_t count);
+    void resize(Pool &pool, Block &block, uint32_t count);
+    void setVertices(Range &range, const VertexFormat &format, const void *vertices, uint32_t vertexCount);
+    void setIndices(Range &range, const std::vector<uint32_t> &indices, size_t vertexCount);
+    bool defragment(Pool &pool, Block Range::*block);
+    GLuint createBuffer(const Pool &pool);
+    void pointVertexArray(const Pool &pool);
+    void pointVertexArrays(const Pool &moved);
+    void upload(const Pool &pool, uint32_t first, const void *data, size_t bytes);
+    void updateGauges();
+
+    static uint32_t indexWords(uint32_t indexCount, GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_SHORT ? (indexCount + 1) / 2 : indexCount;
+    }
+    static GLenum glType(VertexComponent type);
+};
+
+GeometryArena::GeometryArena(IngestStats &stats, size_t initialVertices)
+    : stats(stats), indexPool{sizeof(uint32_t), static_cast<uint32_t>(initialVertices)}
+{
+    for (size_t key = 0; key < vertexPools.size(); ++key)
+    {
+        vertexPools[key].unitBytes = VertexFormat::Get(static_cast<uint8_t>(key)).stride;
+        vertexPools[key].capacity = static_cast<uint32_t>(initialVertices);
+        vertexPools[key].format = static_cast<uint8_t>(key);
+    }
+}
+
+GeometryArena::~GeometryArena()
+{
+    for (Pool &pool : vertexPools)
+    {
+        if (pool.vao != 0)
+        {
+            glDeleteVertexArrays(1, &pool.vao);
+            glDeleteBuffers(1, &pool.buffer);
+        }
+    }
+    if (initialized)
+        glDeleteBuffers(1, &indexPool.buffer);
+}
+
+void GeometryArena::initialize()
+{
+    indexPool.buffer = createBuffer(indexPool);
+    indexPool.freeBlocks.emplace(0, indexPool.capacity);
+
+    // what the shaders read for attributes a format leaves out: no normal
+    // (w = 0, where a stored normal reads w = 1) and opaque white
+    glVertexAttrib4f(VERTEX_NORMAL_LOCATION, 0.0f, 0.0f, 0.0f, 0.0f);
+    glVertexAttrib4f(VERTEX_COLOR_LOCATION, 1.0f, 1.0f, 1.0f, 1.0f);
+    initialized = true;
+}
+
+GeometryArena::Pool &GeometryArena::vertexPool(uint8_t format)
+{
+    if (!initialized)
+        initialize();
+
+    Pool &pool = vertexPools[format];
+    if (pool.vao == 0)
+    {
+        glGenVertexArrays(1, &pool.vao);
+        pool.buffer = createBuffer(pool);
+        pool.freeBlocks.emplace(0, pool.capacity);
+        pointVertexArray(pool);
+    }
+    return pool;
+}
+
+// Created through the copy target, so the element array binding of whatever VAO is bound stays untouched
+GLuint GeometryArena::createBuffer(const Pool &pool)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(pool.capacity) * pool.unitBytes, nullptr, GL_STATIC_DRAW);
+    return buffer;
+}
+
+GLenum GeometryArena::glType(VertexComponent type)
+{
+    switch (type)
+    {
+    case VertexComponent::Float16:
+        return GL_HALF_FLOAT;
+    case VertexComponent::Int16:
+        return GL_SHORT;
+    case VertexComponent::Uint16:
+        return GL_UNSIGNED_SHORT;
+    case VertexComponent::Uint8:
+        return GL_UNSIGNED_BYTE;
+    default:
+        return GL_FLOAT;
+    }
+}
+
+void GeometryArena::pointVertexArray(const Pool &pool)
+{
+    const VertexFormat &format = VertexFormat::Get(pool.format);
+    glBindVertexArray(pool.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.buffer);
+    for (uint32_t i = 0; i < format.attributeCount; ++i)
+    {
+        const VertexAttribute &attribute = format.attributes[i];
+        glVertexAttribPointer(attribute.location, attribute.components, glType(attribute.type), attribute.normalized ? GL_TRUE : GL_FALSE,
+                              format.stride, reinterpret_cast<const void *>(static_cast<uintptr_t>(attribute.offset)));
+        glEnableVertexAttribArray(attribute.location);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexPool.buffer);
+    glBindVertexArray(0);
+}
+
+// Re-points the VAOs reading a buffer that was just replaced
+void GeometryArena::pointVertexArrays(const Pool &moved)
+{
+    if (&moved != &indexPool)
+    {
+        pointVertexArray(moved);
+        return;
+    }
+    for (const Pool &pool : vertexPools)
+    {
+        if (pool.vao != 0)
+            pointVertexArray(pool);
+    }
+}
+
+void GeometryArena::upload(const Pool &pool, uint32_t first, const void *data, size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(first) * pool.unitBytes, bytes, data);
+}
+
+void GeometryArena::PackIndices(const std::vector<uint32_t> &indices, size_t vertexCount, std::vector<unsigned char> &out)
+{
+    if (IndexType(vertexCount) == GL_UNSIGNED_INT)
+    {
+        out.resize(indices.size() * sizeof(uint32_t));
+        std::memcpy(out.data(), indices.data(), out.size());
+        return;
+    }
+    out.resize(indices.size() * sizeof(uint16_t));
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        uint16_t index = static_cast<uint16_t>(indices[i]);
+        std::memcpy(out.data() + i * sizeof(uint16_t), &index, sizeof(uint16_t));
+    }
+}
+
+uint32_t GeometryArena::Allocate(const VertexFormat &format, const void *vertices, uint32_t vertexCount, const std::vector<uint32_t> &indices)
+{
+    uint32_t handle;
+    if (!freeHandles.empty())
+    {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+    }
+    else
+    {
+        handle = static_cast<uint32_t>(ranges.size());
+        ranges.emplace_back();
+    }
+
+    Range &range = ranges[handle];
+    range = Range{};
+    range.format = format.key;
+    range.live = true;
+    setVertices(range, format, vertices, vertexCount);
+    setIndices(range, indices, vertexCount);
+
+    updateGauges();
+    return handle;
+}
+
+uint32_t GeometryArena::Allocate(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+{
+    return Allocate(VertexFormat::Default(), vertices.data(), static_cast<uint32_t>(vertices.size()), indices);
+}
+
+void GeometryArena::Update(uint32_t handle, const VertexFormat &format, const void *vertices, uint32_t vertexCount,
+                           const std::vector<uint32_t> &indices)
+{
+    Range &range = ranges[handle];
+    setVertices(range, format, vertices, vertexCount);
+    setIndices(range, indices, vertexCount);
+    updateGauges();
+}
+
+void GeometryArena::Update(uint32_t handle, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+{
+    Update(handle, VertexFormat::Default(), vertices.data(), static_cast<uint32_t>(vertices.size()), indices);
+}
+
+// Stores the vertices of a range, moving it to the pool of format when that changed
+void GeometryArena::setVertices(Range &range, const VertexFormat &format, const void *vertices, uint32_t vertexCount)
+{
+    if (range.format != format.key)
+    {
+        Pool &previous = vertexPools[range.format];
+        release(previous, range.vertices.first, range.vertices.capacity);
+        previous.used -= range.vertices.capacity;
+        range.vertices = Block{};
+        range.format = format.key;
+    }
+    Pool &pool = vertexPool(format.key);
+    resize(pool, range.vertices, vertexCount);
+    upload(pool, range.vertices.first, vertices, static_cast<size_t>(vertexCount) * format.stride);
+}
+
+void GeometryArena::CopyFrom(uint32_t handle, GLuint source, GLintptr vertexOffset, uint32_t vertexCount,
+                             GLintptr indexOffset, uint32_t indexCount)
+{
+    Range &range = ranges[handle];
+    Pool &pool = vertexPool(range.format);
+    resize(pool, range.vertices, vertexCount);
+    range.indexCount = indexCount;
+    range.indexType = IndexType(vertexCount);
+    resize(indexPool, range.indices, indexWords(indexCount, range.indexType));
+
+    glBindBuffer(GL_COPY_READ_BUFFER, source);
+    if (vertexCount > 0)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, vertexOffset,
+                            static_cast<GLintptr>(range.vertices.first) * pool.unitBytes, static_cast<GLsizeiptr>(vertexCount) * pool.unitBytes);
+    }
+    if (indexCount > 0)
+    {
+        GLsizeiptr bytes = static_cast<GLsizeiptr>(indexCount) * IndexBytes(vertexCount);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indexPool.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, indexOffset, IndexOffset(handle), bytes);
+    }
+    updateGauges();
+}
+
+void GeometryArena::setIndices(Range &range, const std::vector<uint32_t> &indices, size_t vertexCount)
+{
+    range.indexCount = static_cast<uint32_t>(indices.size());
+    range.indexType = IndexType(vertexCount);
+    resize(indexPool, range.indices, indexWords(range.indexCount, range.indexType));
+    if (indices.empty())
+        return;
+    PackIndices(indices, vertexCount, packed);
+    upload(indexPool, range.indices.first, packed.data(), packed.size());
+}
+
+void GeometryArena::Free(uint32_t handle)
+{
+    if (handle == 0 || handle >= ranges.size() || !ranges[handle].live)
+        return;
+
+    Range &range = ranges[handle];
+    Pool &pool = vertexPools[range.format];
+    release(pool, range.vertices.first, range.vertices.capacity);
+    pool.used -= range.vertices.capacity;
+    release(indexPool, range.indices.first, range.indices.capacity);
+    indexPool.used -= range.indices.capacity;
+    range = Range{};
+    freeHandles.push_back(handle);
+    updateGauges();
+}
+
+// Sets the count of a block, moving it when the count outgrows its capacity
+void GeometryArena::resize(Pool &pool, Block &block, uint32_t count)
+{
+    if (count > block.capacity)
+    {
+        release(pool, block.first, block.capacity);
+        pool.used -= block.capacity;
+        block.capacity = count;
+        if (!reserve(pool, count, block.first))
+        {
+            grow(pool, count);
+            reserve(pool, count, block.first);
+        }
+        pool.used += count;
+    }
+    block.count = count;
+}
+
+// First fit; takes count units from the lowest free block that holds them
+bool GeometryArena::reserve(Pool &pool, uint32_t count, uint32_t &first)
+{
+    if (count == 0)
+    {
+        first = 0;
+        return true;
+    }
+    for (auto it = pool.freeBlocks.begin(); it != pool.freeBlocks.end(); ++it)
+    {
+        if (it->second < count)
+            continue;
+        first = it->first;
+        uint32_t remaining = it->second - count;
+        pool.freeBlocks.erase(it);
+        if (remaining > 0)
+            pool.freeBlocks.emplace(first + count, remaining);
+        return true;
+    }
+    return false;
+}
+
+// Returns a block to the free list, merging it with free neighbours
+void GeometryArena::release(Pool &pool, uint32_t first, uint32_t count)
+{
+    if (count == 0)
+        return;
+
+    auto next = pool.freeBlocks.lower_bound(first);
+    if (next != pool.freeBlocks.end() && first + count == next->first)
+    {
+        count += next->second;
+        next = pool.freeBlocks.erase(next);
+    }
+    if (next != pool.freeBlocks.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == first)
+        {
+            previous->second += count;
+            return;
+        }
+    }
+    pool.freeBlocks.emplace(first, count);
+}
+
+// Grows the buffer so its new tail alone holds count units
+void GeometryArena::grow(Pool &pool, uint32_t count)
+{
+    uint32_t oldCapacity = pool.capacity;
+    pool.capacity = std::max(pool.capacity * 2, pool.capacity + count);
+
+    GLuint buffer = createBuffer(pool);
+    glBindBuffer(GL_COPY_READ_BUFFER, pool.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(oldCapacity) * pool.unitBytes);
+    glDeleteBuffers(1, &pool.buffer);
+    pool.buffer = buffer;
+    pointVertexArrays(pool);
+
+    release(pool, oldCapacity, pool.capacity - oldCapacity);
+    stats.geometryArenaGrowths.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool GeometryArena::DefragmentIfNeeded()
+{
+    bool moved = false;
+    for (Pool &pool : vertexPools)
+    {
+        if (pool.vao != 0 && defragment(pool, &Range::vertices))
+        {
+            pointVertexArrays(pool);
+            moved = true;
+        }
+    }
+    if (initialized && defragment(indexPool, &Range::indices))
+    {
+        pointVertexArrays(indexPool);
+        moved = true;
+    }
+    if (moved)
+    {
+        stats.geometryArenaDefragmentations.fetch_add(1, std::memory_order_relaxed);
+        updateGauges();
+    }
+    return moved;
+}
+
+bool GeometryArena::defragment(Pool &pool, Block Range::*member)
+{
+    if (pool.freeBlocks.size() < 2)
+        return false;
+
+    uint32_t freeUnits = pool.capacity - pool.used;
+    uint32_t largest = 0;
+    for (auto &[first, size] : pool.freeBlocks)
+        largest = std::max(largest, size);
+    // only worth a copy when a quarter of the buffer is free and no block holds half of it
+    if (freeUnits < pool.capacity / 4 || largest * 2 > freeUnits)
+        return false;
+
+    bool indices = &pool == &indexPool;
+    std::vector<uint32_t> live;
+    for (uint32_t handle = 1; handle < ranges.size(); ++handle)
+    {
+        const Range &range = ranges[handle];
+        if (range.live && (range.*member).capacity > 0 && (indices || range.format == pool.format))
+            live.push_back(handle);
+    }
+    std::sort(live.begin(), live.end(), [&](uint32_t a, uint32_t b)
+              { return (ranges[a].*member).first < (ranges[b].*member).first; });
+
+    GLuint buffer = createBuffer(pool);
+    glBindBuffer(GL_COPY_READ_BUFFER, pool.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    uint32_t cursor = 0;
+    for (uint32_t handle : live)
+    {
+        Block &block = ranges[handle].*member;
+        if (block.count > 0)
+        {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                static_cast<GLintptr>(block.first) * pool.unitBytes,
+                                static_cast<GLintptr>(cursor) * pool.unitBytes,
+                                static_cast<GLsizeiptr>(block.count) * pool.unitBytes);
+        }
+        block.first = cursor;
+        // the slack kept for in-place updates is given back
+        block.capacity = block.count;
+        cursor += block.count;
+    }
+    glDeleteBuffers(1, &pool.buffer);
+    pool.buffer = buffer;
+
+    pool.used = cursor;
+    pool.freeBlocks.clear();
+    if (cursor < pool.capacity)
+        pool.freeBlocks.emplace(cursor, pool.capacity - cursor);
+    return true;
+}
+
+void GeometryArena::updateGauges()
+{
+    uint64_t capacity = 0, used = 0, largest = 0, freeBlocks = 0, formats = 0;
+    for (const Pool &pool : vertexPools)
+    {
+        if (pool.vao == 0)
+            continue;
+        capacity += static_cast<uint64_t>(pool.capacity) * pool.unitBytes;
+        used += static_cast<uint64_t>(pool.used) * pool.unitBytes;
+        for (auto &[first, size] : pool.freeBlocks)
+            largest = std::max(largest, static_cast<uint64_t>(size) * pool.unitBytes);
+        freeBlocks += pool.freeBlocks.size();
+        ++formats;
+    }
+
+    stats.geometryArenaCapacityBytes.store(capacity, std::memory_order_relaxed);
+    stats.geometryArenaUsedBytes.store(used, std::memory_order_relaxed);
+    stats.geometryArenaIndexCapacityBytes.store(static_cast<uint64_t>(indexPool.capacity) * indexPool.unitBytes, std::memory_order_relaxed);
+    stats.geometryArenaIndexUsedBytes.store(static_cast<uint64_t>(indexPool.used) * indexPool.unitBytes, std::memory_order_relaxed);
+    stats.geometryArenaRanges.store(ranges.size() - 1 - freeHandles.size(), std::memory_order_relaxed);
+    stats.geometryArenaVertexFormats.store(formats, std::memory_order_relaxed);
+    stats.geometryArenaFreeBlocks.store(freeBlocks, std::memory_order_relaxed);
+    stats.geometryArenaLargestFreeBytes.store(largest, std::memory_order_relaxed);
+}
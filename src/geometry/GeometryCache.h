@@ -0,0 +1,174 @@
+#pragma once
+#include <glad.h>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "PreparedMesh.h"
+#include "IngestStats.h"
+#include "GeometryArena.h"
+
+// One unique mesh shared by every entity whose vertex data hashed to its key
+struct CachedGeometry
+{
+    std::vector<unsigned char> vertices; // vertexCount vertices of VertexFormat::Get(format)
+    uint32_t vertexCount = 0;
+    uint8_t format = 0;
+    PositionDecode decode;
+    std::vector<uint32_t> indices;
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    uint32_t range = 0; // GeometryArena range, 0 until first drawn
+    size_t refCount = 0;
+
+    std::list<uint64_t>::iterator lruPosition; // valid while refCount is zero
+
+    size_t Bytes() const { return vertices.size() + indices.size() * IndexBytes(vertexCount); }
+
+    // True if the mesh is this geometry, byte for byte, not just by hash
+    bool Matches(const PreparedMesh &mesh) const
+    {
+        return format == mesh.format && vertexCount == mesh.vertexCount && decode.scale == mesh.decode.scale &&
+               decode.offset == mesh.decode.offset && vertices == mesh.vertices && indices == mesh.indices;
+    }
+};
+
+/**
+ * GeometryCache deduplicates V2 meshes by the content hash computed when they
+ * are prepared. Entities with identical vertex data share one CPU copy and one
+ * GeometryArena range, and hold a reference on the entry through GeometryComponent::meshKey.
+ *
+ * A hash match is only a hit once the bytes compare equal: a different mesh
+ * under a taken key is rehashed to the next key of its probe sequence, so
+ * colliding meshes, accidental or crafted, never share geometry.
+ *
+ * Entries whose last reference is released stay resident so a mesh that comes
+ * back is still a hit, and are evicted least recently released first once
+ * they exceed maxUnreferencedBytes.
+ *
+ * Owned by the render thread: it is touched by MessageSystem and
+ * RenderPreprocessorSystem only, and issues GL calls.
+ */
+class GeometryCache
+{
+public:
+    GeometryCache(IngestStats &stats, GeometryArena &arena, size_t maxUnreferencedBytes = 64 << 20)
+        : stats(stats), arena(arena), maxUnreferencedBytes(maxUnreferencedBytes) {}
+
+    // Takes a reference on the entry for the mesh, adopting its vertices on a miss.
+    // Returns the key to store in GeometryComponent::meshKey
+    uint64_t Acquire(PreparedMesh &&mesh);
+    void Release(uint64_t key);
+
+    // Returns the entry, copying its vertices into the arena on first use
+    const CachedGeometry &Upload(uint64_t key);
+    const CachedGeometry *Find(uint64_t key) const;
+
+private:
+    IngestStats &stats;
+    GeometryArena &arena;
+    size_t maxUnreferencedBytes;
+    size_t unreferencedBytes = 0;
+
+    std::unordered_map<uint64_t, CachedGeometry> entries;
+    // unreferenced keys, least recently released first
+    std::list<uint64_t> lru;
+
+    void evict();
+    void updateGauges();
+};
+
+uint64_t GeometryCache::Acquire(PreparedMesh &&mesh)
+{
+    uint64_t key = mesh.contentHash;
+    auto it = entries.find(key);
+    while (it != entries.end() && !it->second.Matches(mesh))
+    {
+        stats.geometryCacheCollisions.fetch_add(1, std::memory_order_relaxed);
+        key = HashBytes(&key, sizeof(key), 0x9e3779b97f4a7c15ull);
+        it = entries.find(key);
+    }
+    if (it != entries.end())
+    {
+        CachedGeometry &entry = it->second;
+        if (entry.refCount++ == 0)
+        {
+            lru.erase(entry.lruPosition);
+            unreferencedBytes -= entry.Bytes();
+        }
+        stats.geometryCacheHits.fetch_add(1, std::memory_order_relaxed);
+        stats.geometryBytesSaved.fetch_add(mesh.Bytes(), std::memory_order_relaxed);
+        return key;
+    }
+
+    CachedGeometry &entry = entries[key];
+    entry.vertices = std::move(mesh.vertices);
+    entry.vertexCount = mesh.vertexCount;
+    entry.format = mesh.format;
+    entry.decode = mesh.decode;
+    entry.indices = std::move(mesh.indices);
+    entry.boundsMin = mesh.boundsMin;
+    entry.boundsMax = mesh.boundsMax;
+    entry.refCount = 1;
+    stats.geometryCacheMisses.fetch_add(1, std::memory_order_relaxed);
+    updateGauges();
+    return key;
+}
+
+void GeometryCache::Release(uint64_t key)
+{
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.refCount == 0)
+        return;
+
+    CachedGeometry &entry = it->second;
+    if (--entry.refCount == 0)
+    {
+        entry.lruPosition = lru.insert(lru.end(), key);
+        unreferencedBytes += entry.Bytes();
+        evict();
+    }
+}
+
+const CachedGeometry &GeometryCache::Upload(uint64_t key)
+{
+    CachedGeometry &entry = entries.at(key);
+    if (entry.range != 0)
+        return entry;
+
+    entry.range = arena.Allocate(VertexFormat::Get(entry.format), entry.vertices.data(), entry.vertexCount, entry.indices);
+    stats.geometryCacheGpuBytes.fetch_add(entry.Bytes(), std::memory_order_relaxed);
+    return entry;
+}
+
+const CachedGeometry *GeometryCache::Find(uint64_t key) const
+{
+    auto it = entries.find(key);
+    return it != entries.end() ? &it->second : nullptr;
+}
+
+void GeometryCache::evict()
+{
+    while (unreferencedBytes > maxUnreferencedBytes && !lru.empty())
+    {
+        auto it = entries.find(lru.front());
+        lru.pop_front();
+
+        CachedGeometry &entry = it->second;
+        unreferencedBytes -= entry.Bytes();
+        if (entry.range != 0)
+        {
+            arena.Free(entry.range);
+            stats.geometryCacheGpuBytes.fetch_sub(entry.Bytes(), std::memory_order_relaxed);
+        }
+        entries.erase(it);
+        stats.geometryCacheEvictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    updateGauges();
+}
+
+void GeometryCache::updateGauges()
+{
+    stats.geometryCacheMeshes.store(entries.size(), std::memory_order_relaxed);
+    stats.geometryCacheUnreferenced.store(lru.size(), std::memory_order_relaxed);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Largest vertex count whose indices fit in 16 bits
+constexpr size_t MAX_SHORT_INDEXED_VERTICES = 1 << 16;
+
+// Bytes an index of a mesh with vertexCount vertices takes on the GPU
+inline size_t IndexBytes(size_t vertexCount)
+{
+    return vertexCount <= MAX_SHORT_INDEXED_VERTICES ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// True if the indices only restate the vertex order, so drawing the vertices
+// directly is the same mesh
+inline bool IsIdentityIndices(const std::vector<uint32_t> &indices, size_t vertexCount)
+{
+    if (indices.size() != vertexCount)
+        return false;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        if (indices[i] != i)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Merges bit-identical vertices of stride bytes each, keeping the first
+ * occurrence of each in order, and rewrites indices to point at the merged
+ * vertices. Empty indices stand for one index per vertex. When nothing merged
+ * and the indices are the identity they are cleared, so meshes without shared
+ * vertices stay non-indexed and pay nothing for an index buffer. The stride
+ * is a multiple of 4, as every VertexFormat is.
+ *
+ * Returns the number of vertices removed.
+ */
+inline size_t WeldVertices(std::vector<unsigned char> &vertices, size_t stride, std::vector<uint32_t> &indices)
+{
+    size_t original = stride ? vertices.size() / stride : 0;
+    if (indices.empty())
+    {
+        indices.resize(original);
+        for (size_t i = 0; i < original; ++i)
+            indices[i] = static_cast<uint32_t>(i);
+    }
+
+    struct VertexKey
+    {
+        const unsigned char *vertex;
+        size_t stride;
+        bool operator==(const VertexKey &other) const { return std::memcmp(vertex, other.vertex, stride) == 0; }
+    };
+    struct VertexKeyHash
+    {
+        size_t operator()(const VertexKey &key) const
+        {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (size_t offset = 0; offset < key.stride; offset += sizeof(uint32_t))
+            {
+                uint32_t word;
+                std::memcpy(&word, key.vertex + offset, sizeof(word));
+                hash = (hash ^ word) * 0x100000001b3ull;
+            }
+            return static_cast<size_t>(hash ^ (hash >> 32));
+        }
+    };
+
+    // new index of every original vertex
+    std::vector<uint32_t> remap(original);
+    std::vector<unsigned char> welded;
+    welded.reserve(vertices.size());
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> seen;
+    seen.reserve(original);
+    for (size_t i = 0; i < original; ++i)
+    {
+        const unsigned char *vertex = vertices.data() + i * stride;
+        auto [it, inserted] = seen.emplace(VertexKey{vertex, stride}, static_cast<uint32_t>(welded.size() / stride));
+        if (inserted)
+            welded.insert(welded.end(), vertex, vertex + stride);
+        remap[i] = it->second;
+    }
+
+    for (uint32_t &index : indices)
+        index = remap[index];
+    size_t kept = welded.size() / stride;
+    size_t removed = original - kept;
+    if (removed > 0)
+        vertices = std::move(welded);
+    if (IsIdentityIndices(indices, kept))
+        indices.clear();
+    return removed;
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include <glad.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "IngestStats.h"
+
+/**
+ * StreamBuffer is a ring of per-frame regions for data the CPU rewrites every
+ * frame or on every change: rebuilt text geometry and per-frame instance
+ * attributes. Data is written into the region of the current frame and used
+ * from there on the GPU (copied into the GeometryArena, or read as instance
+ * attributes), so the buffers the draws read are never rewritten from the CPU.
+ *
+ * Each region is fenced when its frame ends and waited on before it is
+ * written again, so nothing still in flight is overwritten. With GL 4.4 or
+ * ARB_buffer_storage the buffer is mapped once, persistently and coherently;
+ * otherwise writes go through unsynchronized glMapBufferRange, which the
+ * fences make safe. Data that outgrows a region replaces the buffer with a
+ * larger one, orphaning the old storage to the draws still using it.
+ *
+ * Owned by the render thread.
+ */
+class StreamBuffer
+{
+public:
+    static constexpr size_t REGIONS = 3;
+    static constexpr size_t ALIGNMENT = 16; // enough for any vertex attribute offset
+
+    StreamBuffer(IngestStats &stats, size_t regionBytes = 1 << 20) : stats(stats), regionBytes(regionBytes) {}
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+    // Creates the buffer, persistently mapped when the driver supports it. Needs a current context
+    void Initialize(GLADloadproc getProcAddress);
+
+    // Copies data into this frame's region and returns its offset in Buffer().
+    // Buffer() may change on a write, so read it after each one
+    GLintptr Write(const void *data, size_t bytes);
+    GLuint Buffer() const { return buffer; }
+    // Makes room for bytes more this frame, so the writes that follow, as long
+    // as they fit, land in the same Buffer(). Each write may pad to ALIGNMENT
+    void Reserve(size_t bytes);
+
+    // Fences the region written this frame and moves on to the next one
+    void EndFrame();
+
+private:
+    typedef void(APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+    static constexpr GLbitfield MAP_PERSISTENT_BIT = 0x0040;
+    static constexpr GLbitfield MAP_COHERENT_BIT = 0x0080;
+
+    IngestStats &stats;
+    size_t regionBytes;
+    GLuint buffer = 0;
+    char *mapped = nullptr; // set when persistently mapped
+    BufferStorageProc bufferStorage = nullptr;
+
+    size_t region = 0;
+    size_t cursor = 0; // within the current region
+    bool regionReady = false;
+    std::array<GLsync, REGIONS> fences{};
+
+    void createBuffer();
+    void destroyBuffer();
+    void waitForRegion();
+    size_t claim(size_t bytes);
+};
+
+StreamBuffer::~StreamBuffer()
+{
+    destroyBuffer();
+}
+
+void StreamBuffer::Initialize(GLADloadproc getProcAddress)
+{
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 4);
+
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount && !supported; ++i)
+    {
+        const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        supported = name && std::string(name) == "GL_ARB_buffer_storage";
+    }
+    if (supported)
+        bufferStorage = reinterpret_cast<BufferStorageProc>(getProcAddress("glBufferStorage"));
+
+    createBuffer();
+    stats.streamPersistent.store(mapped != nullptr, std::memory_order_relaxed);
+    std::cout << "Stream buffer " << (mapped ? "persistently mapped" : "orphaned with unsynchronized maps") << std::endl;
+}
+
+void StreamBuffer::createBuffer()
+{
+    GLsizeiptr size = static_cast<GLsizeiptr>(regionBytes * REGIONS);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (bufferStorage)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | MAP_PERSISTENT_BIT | MAP_COHERENT_BIT;
+        bufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+        mapped = static_cast<char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+    }
+    if (!mapped)
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StreamBuffer::destroyBuffer()
+{
+    for (GLsync &fence : fences)
+    {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (buffer == 0)
+        return;
+    if (mapped)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mapped = nullptr;
+    }
+    // GL keeps the storage alive until the commands reading it have finished
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+// Blocks until the GPU is done with the current region from its last use
+void StreamBuffer::waitForRegion()
+{
+    GLsync &fence = fences[region];
+    if (fence)
+    {
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            stats.streamWaits.fetch_add(1, std::memory_order_relaxed);
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            {
+            }
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    regionReady = true;
+}
+
+// Returns the aligned start of bytes in the current region, growing the buffer
+// when they do not fit
+size_t StreamBuffer::claim(size_t bytes)
+{
+    if (!regionReady)
+        waitForRegion();
+
+    size_t start = (cursor + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (start + bytes > regionBytes)
+    {
+        // outgrown: start over in a larger buffer; draws queued on the old one keep it
+        while (regionBytes < bytes)
+            regionBytes *= 2;
+        if (start > 0)
+            regionBytes *= 2;
+        destroyBuffer();
+        createBuffer();
+        region = 0;
+        cursor = 0;
+        start = 0;
+        stats.streamGrowths.fetch_add(1, std::memory_order_relaxed);
+    }
+    return start;
+}
+
+void StreamBuffer::Reserve(size_t bytes)
+{
+    claim(bytes);
+}
+
+GLintptr StreamBuffer::Write(const void *data, size_t bytes)
+{
+    size_t start = claim(bytes);
+    GLintptr offset = static_cast<GLintptr>(region * regionBytes + start);
+    if (bytes > 0)
+    {
+        if (mapped)
+        {
+            std::memcpy(mapped + offset, data, bytes);
+        }
+        else
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            void *target = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, bytes,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            if (target)
+            {
+                std::memcpy(target, data, bytes);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+    }
+
+    cursor = start + bytes;
+    stats.streamBytes.fetch_add(bytes, std::memory_order_relaxed);
+    return offset;
+}
+
+void StreamBuffer::EndFrame()
+{
+    if (!regionReady)
+        return; // nothing written this frame
+
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region = (region + 1) % REGIONS;
+    cursor = 0;
+    regionReady = false;
+}
@@ -0,0 +1,339 @@
+#pragma once
+#include <glm.hpp>
+#include <gtc/packing.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "Vertex.h"
+
+// How a mesh stores its positions, chosen per mesh by vertexData.format
+enum PositionFormat : uint8_t
+{
+    POSITION_FORMAT_AUTO = 0, // float32 below COMPACT_VERTEX_MIN vertices, snorm16 from there
+    POSITION_FORMAT_FLOAT32 = 1,
+    POSITION_FORMAT_FLOAT16 = 2,
+    POSITION_FORMAT_SNORM16 = 3, // normalised to the bounding box; see PositionDecode
+};
+
+enum TexCoordFormat : uint8_t
+{
+    TEXCOORD_FORMAT_NONE = 0,
+    TEXCOORD_FORMAT_FLOAT32 = 1,
+    TEXCOORD_FORMAT_FLOAT16 = 2,
+    TEXCOORD_FORMAT_UNORM16 = 3, // texture coordinates within [0, 1]
+};
+
+// Attribute locations the vertex formats feed and the shaders declare
+enum VertexAttributeLocation : uint32_t
+{
+    VERTEX_POSITION_LOCATION = 0,
+    VERTEX_TEXCOORD_LOCATION = 1,
+    // 2-6 are the per instance model matrix and color, see InstanceBuffer
+    VERTEX_NORMAL_LOCATION = 7,
+    VERTEX_COLOR_LOCATION = 8,
+};
+
+enum class VertexComponent : uint8_t
+{
+    Float32,
+    Float16,
+    Int16,
+    Uint16,
+    Uint8,
+};
+
+struct VertexAttribute
+{
+    uint32_t location = 0;
+    uint32_t components = 0;
+    VertexComponent type = VertexComponent::Float32;
+    bool normalized = false; // integers read as [0, 1] or [-1, 1] rather than as their value
+    uint32_t offset = 0;
+};
+
+// Meshes with at least this many vertices are stored compact unless they ask otherwise
+constexpr size_t COMPACT_VERTEX_MIN = 1024;
+constexpr size_t VERTEX_FORMAT_COUNT = 64;
+
+/**
+ * VertexFormat describes one interleaved vertex layout: positions in one of
+ * the PositionFormats, then the optional texture coordinates, normals and
+ * colors, each attribute starting on a 4 byte boundary.
+ *
+ *   position   float32 x3 (12 bytes), or float16 / snorm16 x3 padded to 8
+ *   texCoord   float32 x2 (8), float16 x2 or unorm16 x2 (4)
+ *   normal     octahedral snorm16 x2 (4)
+ *   color      unorm8 x4 (4)
+ *
+ * A format is identified by its key, below VERTEX_FORMAT_COUNT; GeometryArena
+ * keeps a buffer and a VAO per key. Attributes a format leaves out read the
+ * GL current attribute value, which GeometryArena sets to "no normal" and
+ * opaque white. The Default format is the layout of struct Vertex.
+ */
+struct VertexFormat
+{
+    uint8_t key = 0;
+    uint32_t stride = 0;
+    uint32_t attributeCount = 0;
+    std::array<VertexAttribute, 4> attributes{};
+
+    static constexpr uint8_t NORMALS = 1 << 4;
+    static constexpr uint8_t COLORS = 1 << 5;
+
+    static uint8_t Key(PositionFormat positions, TexCoordFormat texCoords, bool normals, bool colors)
+    {
+        return static_cast<uint8_t>(positions | (texCoords << 2) | (normals ? NORMALS : 0) | (colors ? COLORS : 0));
+    }
+    static const VertexFormat &Get(uint8_t key);
+    static const VertexFormat &Default() { return Get(Key(POSITION_FORMAT_FLOAT32, TEXCOORD_FORMAT_FLOAT32, false, false)); }
+
+    PositionFormat Positions() const { return static_cast<PositionFormat>(key & 0x3); }
+    TexCoordFormat TexCoords() const { return static_cast<TexCoordFormat>((key >> 2) & 0x3); }
+    bool HasNormals() const { return key & NORMALS; }
+    bool HasColors() const { return key & COLORS; }
+    bool IsCompact() const { return Positions() != POSITION_FORMAT_FLOAT32; }
+
+    // Bytes a vertex with the same attributes takes as plain floats: xyz,
+    // uv, a normal of three and a color of four
+    uint32_t FloatStride() const
+    {
+        return 12 + (TexCoords() != TEXCOORD_FORMAT_NONE ? 8 : 0) + (HasNormals() ? 12 : 0) + (HasColors() ? 16 : 0);
+    }
+
+private:
+    static VertexFormat build(uint8_t key);
+    void add(uint32_t location, uint32_t components, VertexComponent type, bool normalized, uint32_t bytes)
+    {
+        attributes[attributeCount++] = VertexAttribute{location, components, type, normalized, stride};
+        stride += bytes;
+    }
+};
+
+inline VertexFormat VertexFormat::build(uint8_t key)
+{
+    VertexFormat format;
+    format.key = key;
+    switch (format.Positions())
+    {
+    case POSITION_FORMAT_FLOAT16:
+        format.add(VERTEX_POSITION_LOCATION, 3, VertexComponent::Float16, false, 8);
+        break;
+    case POSITION_FORMAT_SNORM16:
+        // read as integers; the scale to [-1, 1] is part of the PositionDecode
+        format.add(VERTEX_POSITION_LOCATION, 3, VertexComponent::Int16, false, 8);
+        break;
+    default:
+        format.add(VERTEX_POSITION_LOCATION, 3, VertexComponent::Float32, false, 12);
+        break;
+    }
+    switch (format.TexCoords())
+    {
+    case TEXCOORD_FORMAT_FLOAT32:
+        format.add(VERTEX_TEXCOORD_LOCATION, 2, VertexComponent::Float32, false, 8);
+        break;
+    case TEXCOORD_FORMAT_FLOAT16:
+        format.add(VERTEX_TEXCOORD_LOCATION, 2, VertexComponent::Float16, false, 4);
+        break;
+    case TEXCOORD_FORMAT_UNORM16:
+        format.add(VERTEX_TEXCOORD_LOCATION, 2, VertexComponent::Uint16, true, 4);
+        break;
+    case TEXCOORD_FORMAT_NONE:
+        break;
+    }
+    if (format.HasNormals())
+        format.add(VERTEX_NORMAL_LOCATION, 2, VertexComponent::Int16, true, 4);
+    if (format.HasColors())
+        format.add(VERTEX_COLOR_LOCATION, 4, VertexComponent::Uint8, true, 4);
+    return format;
+}
+
+inline const VertexFormat &VertexFormat::Get(uint8_t key)
+{
+    static const std::array<VertexFormat, VERTEX_FORMAT_COUNT> formats = []
+    {
+        std::array<VertexFormat, VERTEX_FORMAT_COUNT> all;
+        for (size_t key = 0; key < all.size(); ++key)
+            all[key] = build(static_cast<uint8_t>(key));
+        return all;
+    }();
+    return formats[key % VERTEX_FORMAT_COUNT];
+}
+
+static_assert(sizeof(Vertex) == 20, "the Default VertexFormat is the layout of Vertex");
+
+// Maps stored positions back to object space: position = offset + scale * stored.
+// Identity except for snorm16 positions, whose decode is folded into the model matrix
+struct PositionDecode
+{
+    glm::vec3 scale{1.0f};
+    glm::vec3 offset{0.0f};
+
+    bool IsIdentity() const { return scale == glm::vec3(1.0f) && offset == glm::vec3(0.0f); }
+    glm::mat4 Matrix() const
+    {
+        glm::mat4 matrix(1.0f);
+        matrix[0][0] = scale.x;
+        matrix[1][1] = scale.y;
+        matrix[2][2] = scale.z;
+        matrix[3] = glm::vec4(offset, 1.0f);
+        return matrix;
+    }
+    glm::mat4 Inverse() const
+    {
+        glm::mat4 matrix(1.0f);
+        matrix[0][0] = 1.0f / scale.x;
+        matrix[1][1] = 1.0f / scale.y;
+        matrix[2][2] = 1.0f / scale.z;
+        matrix[3] = glm::vec4(-offset / scale, 1.0f);
+        return matrix;
+    }
+};
+
+// Decode for positions stored in the given format within the box low..high
+inline PositionDecode MakePositionDecode(PositionFormat positions, const glm::vec3 &low, const glm::vec3 &high)
+{
+    PositionDecode decode;
+    if (positions != POSITION_FORMAT_SNORM16)
+        return decode;
+    decode.offset = (low + high) * 0.5f;
+    glm::vec3 extents = (high - low) * 0.5f;
+    for (int axis = 0; axis < 3; ++axis)
+        decode.scale[axis] = extents[axis] > 0.0f ? extents[axis] / 32767.0f : 1.0f;
+    return decode;
+}
+
+/**
+ * Picks the format a mesh is stored in. Positions follow the request, with
+ * POSITION_FORMAT_AUTO going compact from COMPACT_VERTEX_MIN vertices and
+ * float16 falling back to snorm16 past the half float range. Texture
+ * coordinates stay float32 next to float32 positions; otherwise they take
+ * unorm16 when they lie within [0, 1], so atlas lookups keep 16 bits, and
+ * float16 when they repeat.
+ */
+inline uint8_t ChooseVertexFormat(PositionFormat requested, size_t vertexCount, const glm::vec3 &low, const glm::vec3 &high,
+                                  const float *texCoords, bool normals, bool colors)
+{
+    const float halfMax = 65504.0f;
+
+    PositionFormat positions = requested;
+    if (positions == POSITION_FORMAT_AUTO)
+        positions = vertexCount >= COMPACT_VERTEX_MIN ? POSITION_FORMAT_SNORM16 : POSITION_FORMAT_FLOAT32;
+    glm::vec3 reach = glm::max(-low, high);
+    if (positions == POSITION_FORMAT_FLOAT16 && std::max(reach.x, std::max(reach.y, reach.z)) > halfMax)
+        positions = POSITION_FORMAT_SNORM16;
+
+    TexCoordFormat texCoordFormat = TEXCOORD_FORMAT_NONE;
+    if (texCoords)
+    {
+        texCoordFormat = TEXCOORD_FORMAT_FLOAT32;
+        if (positions != POSITION_FORMAT_FLOAT32)
+        {
+            float smallest = 0.0f, largest = 0.0f;
+            if (vertexCount > 0)
+            {
+                auto [first, last] = std::minmax_element(texCoords, texCoords + vertexCount * 2);
+                smallest = *first;
+                largest = *last;
+            }
+            if (smallest >= 0.0f && largest <= 1.0f)
+                texCoordFormat = TEXCOORD_FORMAT_UNORM16;
+            else if (smallest >= -halfMax && largest <= halfMax)
+                texCoordFormat = TEXCOORD_FORMAT_FLOAT16;
+        }
+    }
+    return VertexFormat::Key(positions, texCoordFormat, normals, colors);
+}
+
+// Octahedral mapping of a direction onto [-1, 1]^2 (Meyer et al.); the
+// shaders undo it in octahedralDecode. A zero vector maps to +z
+inline glm::vec2 OctahedralEncode(const glm::vec3 &normal)
+{
+    float sum = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (sum == 0.0f)
+        return glm::vec2(0.0f);
+    glm::vec3 n = normal / sum;
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        glm::vec2 sign(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+        p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * sign;
+    }
+    return p;
+}
+
+/**
+ * Interleaves vertexCount vertices into format. texCoords, normals and colors
+ * hold 2, 3 and colorChannels (3 or 4) floats per vertex and are only read
+ * when the format has them. Padding is zeroed, so equal vertices encode to
+ * equal bytes.
+ */
+inline void EncodeVertices(const VertexFormat &format, size_t vertexCount, const float *positions, const float *texCoords,
+                           const float *normals, const float *colors, size_t colorChannels, const PositionDecode &decode,
+                           std::vector<unsigned char> &out)
+{
+    out.assign(vertexCount * format.stride, 0);
+    auto put = [](unsigned char *at, const void *value, size_t bytes)
+    { std::memcpy(at, value, bytes); };
+
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        unsigned char *vertex = out.data() + i * format.stride;
+        for (uint32_t a = 0; a < format.attributeCount; ++a)
+        {
+            const VertexAttribute &attribute = format.attributes[a];
+            unsigned char *at = vertex + attribute.offset;
+            switch (attribute.location)
+            {
+            case VERTEX_POSITION_LOCATION:
+                for (int c = 0; c < 3; ++c)
+                {
+                    float value = positions[i * 3 + c];
+                    if (attribute.type == VertexComponent::Float32)
+                        put(at + c * 4, &value, 4);
+                    else if (attribute.type == VertexComponent::Float16)
+                    {
+                        uint16_t half = glm::packHalf1x16(value);
+                        put(at + c * 2, &half, 2);
+                    }
+                    else
+                    {
+                        float stored = std::round((value - decode.offset[c]) / decode.scale[c]);
+                        int16_t quantized = static_cast<int16_t>(std::clamp(stored, -32767.0f, 32767.0f));
+                        put(at + c * 2, &quantized, 2);
+                    }
+                }
+                break;
+            case VERTEX_TEXCOORD_LOCATION:
+                for (int c = 0; c < 2; ++c)
+                {
+                    float value = texCoords[i * 2 + c];
+                    if (attribute.type == VertexComponent::Float32)
+                        put(at + c * 4, &value, 4);
+                    else
+                    {
+                        uint16_t packed = attribute.type == VertexComponent::Float16 ? glm::packHalf1x16(value) : glm::packUnorm1x16(value);
+                        put(at + c * 2, &packed, 2);
+                    }
+                }
+                break;
+            case VERTEX_NORMAL_LOCATION:
+            {
+                glm::vec2 octahedral = OctahedralEncode(glm::vec3(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]));
+                uint16_t packed[2] = {glm::packSnorm1x16(octahedral.x), glm::packSnorm1x16(octahedral.y)};
+                put(at, packed, sizeof(packed));
+                break;
+            }
+            case VERTEX_COLOR_LOCATION:
+                for (size_t c = 0; c < 4; ++c)
+                {
+                    float value = c < colorChannels ? colors[i * colorChannels + c] : 1.0f;
+                    at[c] = static_cast<unsigned char>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+                }
+                break;
+            }
+        }
+    }
+}
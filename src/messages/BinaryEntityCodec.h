@@ -0,0 +1,362 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "EntityCreationMessageV2.h"
+#include "EntityUpdateMessage.h"
+#include "BufferPool.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "BinaryEntityCodec assumes a little-endian host"
+#endif
+
+/**
+ * BinaryEntityCodec decodes the compact binary form of the V2 entity
+ * protocol, which producers write from the layout below. Every message is a
+ * self-delimiting frame so it can be sent back to back over a stream socket
+ * or as an HTTP body with the application/x-dygl-entity content type.
+ *
+ * Frame layout, all fields little-endian:
+ *
+ *   header (16 bytes)
+ *     u32 magic            "DYGL"
+ *     u16 version          BINARY_PROTOCOL_VERSION
+ *     u16 messageType      BinaryMessageType
+ *     u32 payloadLength    bytes following the header
+ *     u32 flags            BinaryFlags
+ *
+ *   create payload
+ *     i32 id
+ *     f32 position[3], rotation[3], scale[3], color[4]
+ *     u16 shapeType, vertex shader and fragment shader lengths
+ *     the three strings, unterminated
+ *     geometry
+ *
+ *   update payload
+ *     i32 id
+ *     u32 fields           EntityUpdateField bits
+ *     then, only for the fields present and in this order:
+ *     f32 position[3], f32 rotation[3], f32 scale[3], f32 color[4], geometry
+ *
+ *   delete payload
+ *     i32 id
+ *
+ *   geometry, shared by create and update
+ *     u16 vertexFormat     PositionFormat, 0 for auto
+ *     u32 vertexCount
+ *     positions: f32[vertexCount * 3], or with QUANTIZED_POSITIONS
+ *                f32 boundsMin[3], f32 boundsMax[3], u16[vertexCount * 3]
+ *     with INDEXED_GEOMETRY: u32 indexCount, u32[indexCount] indices
+ *     u32 normals, texCoords and colors float counts, then the raw f32 arrays
+ */
+
+const uint32_t BINARY_PROTOCOL_MAGIC = 0x4C475944; // "DYGL" read as little-endian
+const uint16_t BINARY_PROTOCOL_VERSION = 3;
+const size_t BINARY_HEADER_SIZE = 16;
+const size_t BINARY_MAX_FRAME_SIZE = 64 * 1024 * 1024;
+const char BINARY_CONTENT_TYPE[] = "application/x-dygl-entity";
+
+enum BinaryMessageType : uint16_t
+{
+    BINARY_CREATE = 1,
+    BINARY_UPDATE = 2,
+    BINARY_DELETE = 3,
+};
+
+enum BinaryFlags : uint32_t
+{
+    QUANTIZED_POSITIONS = 1 << 0,
+    INDEXED_GEOMETRY = 1 << 1, // positions are followed by triangle indices
+};
+
+struct BinaryFrameHeader
+{
+    uint32_t magic = BINARY_PROTOCOL_MAGIC;
+    uint16_t version = BINARY_PROTOCOL_VERSION;
+    uint16_t messageType = BINARY_CREATE;
+    uint32_t payloadLength = 0;
+    uint32_t flags = 0;
+
+    size_t FrameLength() const { return BINARY_HEADER_SIZE + payloadLength; }
+};
+
+class BinaryEntityCodec
+{
+public:
+    BinaryEntityCodec(BufferPool<float> *bufferPool = nullptr) : bufferPool(bufferPool) {}
+
+    // True if the bytes start with the frame magic; needs at least 4 bytes
+    static bool IsBinaryFrame(const char *data, size_t length);
+    // Reads a header, returning false if fewer than BINARY_HEADER_SIZE bytes are available
+    static bool ReadHeader(const char *data, size_t length, BinaryFrameHeader &header);
+
+    // Decode one complete frame of the given type, returning false and setting Error() on failure
+    bool Decode(const char *data, size_t length, EntityCreationMessageV2 &message);
+    bool DecodeUpdate(const char *data, size_t length, EntityUpdateMessage &message);
+    bool DecodeDelete(const char *data, size_t length, int &id);
+    const std::string &Error() const { return error; }
+
+private:
+    BufferPool<float> *bufferPool;
+    std::string error;
+
+    const char *cursor = nullptr;
+    const char *end = nullptr;
+
+    bool fail(const std::string &reason);
+    bool begin(const char *data, size_t length, BinaryMessageType type, BinaryFrameHeader &header);
+    bool readPositions(const BinaryFrameHeader &header, std::vector<float> &positions);
+    bool readIndices(const BinaryFrameHeader &header, size_t vertexCount, std::vector<uint32_t> &indices);
+    bool readGeometry(const BinaryFrameHeader &header, VertexData &vertexData);
+
+    template <typename T>
+    bool read(T &value);
+    bool readBytes(void *out, size_t length);
+    bool readString(uint16_t length, std::string &out);
+    bool readFloats(uint32_t count, std::vector<float> &out);
+    bool readQuantizedPositions(uint32_t vertexCount, std::vector<float> &out);
+};
+
+bool BinaryEntityCodec::IsBinaryFrame(const char *data, size_t length)
+{
+    uint32_t magic;
+    if (length < sizeof(magic))
+        return false;
+    std::memcpy(&magic, data, sizeof(magic));
+    return magic == BINARY_PROTOCOL_MAGIC;
+}
+
+bool BinaryEntityCodec::ReadHeader(const char *data, size_t length, BinaryFrameHeader &header)
+{
+    if (length < BINARY_HEADER_SIZE)
+        return false;
+    std::memcpy(&header.magic, data, 4);
+    std::memcpy(&header.version, data + 4, 2);
+    std::memcpy(&header.messageType, data + 6, 2);
+    std::memcpy(&header.payloadLength, data + 8, 4);
+    std::memcpy(&header.flags, data + 12, 4);
+    return true;
+}
+
+bool BinaryEntityCodec::begin(const char *data, size_t length, BinaryMessageType type, BinaryFrameHeader &header)
+{
+    error.clear();
+
+    if (!ReadHeader(data, length, header))
+        return fail("truncated header");
+    if (header.magic != BINARY_PROTOCOL_MAGIC)
+        return fail("bad magic");
+    if (header.version != BINARY_PROTOCOL_VERSION)
+        return fail("unsupported protocol version " + std::to_string(header.version));
+    if (header.messageType != type)
+        return fail("unexpected message type " + std::to_string(header.messageType));
+    if (header.FrameLength() > length)
+        return fail("truncated payload");
+
+    cursor = data + BINARY_HEADER_SIZE;
+    end = data + header.FrameLength();
+    return true;
+}
+
+bool BinaryEntityCodec::Decode(const char *data, size_t length, EntityCreationMessageV2 &message)
+{
+    BinaryFrameHeader header;
+    if (!begin(data, length, BINARY_CREATE, header))
+        return false;
+
+    int32_t id;
+    uint16_t shapeTypeLength, vertexShaderLength, fragmentShaderLength;
+    std::vector<float> color;
+    if (!read(id) ||
+        !readFloats(3, message.transform.position) ||
+        !readFloats(3, message.transform.rotation) ||
+        !readFloats(3, message.transform.scale) ||
+        !readFloats(4, color) ||
+        !read(shapeTypeLength) || !read(vertexShaderLength) || !read(fragmentShaderLength) ||
+        !readString(shapeTypeLength, message.shapeType) ||
+        !readString(vertexShaderLength, message.shaders.vertexShader) ||
+        !readString(fragmentShaderLength, message.shaders.fragmentShader))
+    {
+        return fail("truncated entity fields");
+    }
+    // as EntityMessageDecoder::validate does for json
+    if (message.shaders.vertexShader.empty() || message.shaders.fragmentShader.empty())
+        return fail("shaders require vertex and fragment paths");
+    message.id = id;
+    message.uniforms.floatVecUniforms["color"] = std::move(color);
+
+    return readGeometry(header, message.vertexData);
+}
+
+bool BinaryEntityCodec::DecodeUpdate(const char *data, size_t length, EntityUpdateMessage &message)
+{
+    BinaryFrameHeader header;
+    if (!begin(data, length, BINARY_UPDATE, header))
+        return false;
+
+    int32_t id;
+    if (!read(id) || !read(message.fields))
+        return fail("truncated update header");
+    message.id = id;
+
+    if ((message.Has(UPDATE_POSITION) && !readFloats(3, message.transform.position)) ||
+        (message.Has(UPDATE_ROTATION) && !readFloats(3, message.transform.rotation)) ||
+        (message.Has(UPDATE_SCALE) && !readFloats(3, message.transform.scale)))
+    {
+        return fail("truncated transform");
+    }
+    if (message.Has(UPDATE_COLOR) && !readFloats(4, message.uniforms.floatVecUniforms["color"]))
+        return fail("truncated color");
+    if (message.Has(UPDATE_GEOMETRY) && !readGeometry(header, message.vertexData))
+        return false;
+
+    return true;
+}
+
+bool BinaryEntityCodec::DecodeDelete(const char *data, size_t length, int &id)
+{
+    BinaryFrameHeader header;
+    if (!begin(data, length, BINARY_DELETE, header))
+        return false;
+
+    int32_t value;
+    if (!read(value))
+        return fail("truncated id");
+    id = value;
+    return true;
+}
+
+bool BinaryEntityCodec::readPositions(const BinaryFrameHeader &header, std::vector<float> &positions)
+{
+    uint32_t vertexCount;
+    if (!read(vertexCount))
+        return fail("truncated vertex count");
+    // every vertex takes at least 6 bytes, which also keeps vertexCount * 3 in range
+    if (vertexCount > header.payloadLength / 6)
+        return fail("vertex count exceeds payload");
+
+    if (bufferPool)
+        positions = bufferPool->Acquire(static_cast<size_t>(vertexCount) * 3);
+
+    bool positionsRead = (header.flags & QUANTIZED_POSITIONS)
+                             ? readQuantizedPositions(vertexCount, positions)
+                             : readFloats(vertexCount * 3, positions);
+    if (!positionsRead)
+        return fail("truncated positions");
+    return true;
+}
+
+bool BinaryEntityCodec::readIndices(const BinaryFrameHeader &header, size_t vertexCount, std::vector<uint32_t> &indices)
+{
+    indices.clear();
+    if (!(header.flags & INDEXED_GEOMETRY))
+        return true;
+
+    uint32_t indexCount;
+    if (!read(indexCount))
+        return fail("truncated index count");
+    size_t bytes = static_cast<size_t>(indexCount) * sizeof(uint32_t);
+    if (static_cast<size_t>(end - cursor) < bytes)
+        return fail("truncated indices");
+    if (indexCount % 3 != 0)
+        return fail("index count is not a multiple of 3");
+
+    indices.resize(indexCount);
+    std::memcpy(indices.data(), cursor, bytes);
+    cursor += bytes;
+    for (uint32_t index : indices)
+    {
+        if (index >= vertexCount)
+            return fail("index out of range: " + std::to_string(index));
+    }
+    return true;
+}
+
+bool BinaryEntityCodec::readGeometry(const BinaryFrameHeader &header, VertexData &vertexData)
+{
+    uint16_t vertexFormat;
+    if (!read(vertexFormat))
+        return fail("truncated vertex format");
+    if (vertexFormat > POSITION_FORMAT_SNORM16)
+        return fail("unknown vertex format " + std::to_string(vertexFormat));
+    vertexData.positionFormat = static_cast<PositionFormat>(vertexFormat);
+
+    if (!readPositions(header, vertexData.positions) ||
+        !readIndices(header, vertexData.positions.size() / 3, vertexData.indices))
+        return false;
+
+    uint32_t normalCount, texCoordCount, colorCount;
+    if (!read(normalCount) || !read(texCoordCount) || !read(colorCount) ||
+        !readFloats(normalCount, vertexData.normals) ||
+        !readFloats(texCoordCount, vertexData.texCoords) ||
+        !readFloats(colorCount, vertexData.colors))
+    {
+        return fail("truncated vertex attributes");
+    }
+    return true;
+}
+
+bool BinaryEntityCodec::fail(const std::string &reason)
+{
+    error = reason;
+    return false;
+}
+
+template <typename T>
+bool BinaryEntityCodec::read(T &value)
+{
+    return readBytes(&value, sizeof(T));
+}
+
+bool BinaryEntityCodec::readBytes(void *out, size_t length)
+{
+    if (static_cast<size_t>(end - cursor) < length)
+        return false;
+    std::memcpy(out, cursor, length);
+    cursor += length;
+    return true;
+}
+
+bool BinaryEntityCodec::readString(uint16_t length, std::string &out)
+{
+    if (static_cast<size_t>(end - cursor) < length)
+        return false;
+    out.assign(cursor, length);
+    cursor += length;
+    return true;
+}
+
+bool BinaryEntityCodec::readFloats(uint32_t count, std::vector<float> &out)
+{
+    size_t bytes = static_cast<size_t>(count) * sizeof(float);
+    if (static_cast<size_t>(end - cursor) < bytes)
+        return false;
+    out.resize(count);
+    std::memcpy(out.data(), cursor, bytes);
+    cursor += bytes;
+    return true;
+}
+
+bool BinaryEntityCodec::readQuantizedPositions(uint32_t vertexCount, std::vector<float> &out)
+{
+    float boundsMin[3], boundsMax[3];
+    if (!readBytes(boundsMin, sizeof(boundsMin)) || !readBytes(boundsMax, sizeof(boundsMax)))
+        return false;
+
+    size_t count = static_cast<size_t>(vertexCount) * 3;
+    if (static_cast<size_t>(end - cursor) < count * sizeof(uint16_t))
+        return false;
+
+    out.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint16_t q;
+        std::memcpy(&q, cursor + i * sizeof(uint16_t), sizeof(q));
+        size_t axis = i % 3;
+        out[i] = boundsMin[axis] + (boundsMax[axis] - boundsMin[axis]) * (q / 65535.0f);
+    }
+    cursor += count * sizeof(uint16_t);
+    return true;
+}
+
@@ -1,8 +1,11 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include "UniformData.h"
+#include "PreparedMesh.h"
+#include "BufferPool.h"
 
 struct ShaderInfo
 {
@@ -37,8 +40,19 @@ struct VertexData
     std::vector<float> normals;
     std::vector<float> texCoords;
     std::vector<float> colors;
+    std::vector<uint32_t> indices; // optional, three per triangle into the vertices above
+    PositionFormat positionFormat = POSITION_FORMAT_AUTO;
 };
 
+// Returns the decoded attribute buffers to the pool the network threads draw from
+inline void ReleaseVertexData(BufferPool<float> &pool, VertexData &vertexData)
+{
+    pool.Release(std::move(vertexData.positions));
+    pool.Release(std::move(vertexData.normals));
+    pool.Release(std::move(vertexData.texCoords));
+    pool.Release(std::move(vertexData.colors));
+}
+
 struct EntityCreationMessageV2
 {
     int id;
@@ -47,6 +61,8 @@ struct EntityCreationMessageV2
     ShaderInfo shaders;
     UniformData uniforms;
     VertexData vertexData;
+    PreparedMesh mesh; // vertexData interleaved off the render thread, once ready
+    uint64_t sequence = 0; // ingest order, stamped by IngestBatch
 
     EntityCreationMessageV2() {}
 
@@ -1,7 +1,9 @@
 #pragma once
+#include <cstdint>
 
 struct EntityDeletionMessage {
     int id;
+    uint64_t sequence = 0; // ingest order, stamped by IngestBatch
 
     EntityDeletionMessage(int id) : id(id) {}
 };
\ No newline at end of file
@@ -0,0 +1,430 @@
+#pragma once
+#include <json.hpp>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "EntityCreationMessageV2.h"
+#include "BufferPool.h"
+
+/**
+ * EntityMessageDecoder is a streaming decoder for the V2 entity protocol. It
+ * consumes nlohmann's SAX events and writes fields straight into an
+ * EntityCreationMessageV2, so vertex arrays go from text to float buffers
+ * without an intermediate json DOM. The message is validated as it is read
+ * and decoding stops at the first schema violation.
+ *
+ * Expected shape:
+ *   { "type": "create" | "update" | "delete", "id": 1 | "1", "shapeType": "...",
+ *     "transform": { "position": [x,y,z], "rotation": [...], "scale": [x,y,z] },
+ *     "shaders": { "vertex": "...", "fragment": "..." },
+ *     "uniforms": { "<name>": { "type": "floatVecUniforms", "value": [...] } },
+ *     "vertexData": { "positions": [...], "normals": [...], "texCoords": [...], "colors": [...],
+ *                     "indices": [...], "format": "auto" } }
+ *
+ * "indices" is optional: vertex indices, three per triangle. Without it every
+ * three positions form a triangle.
+ *
+ * "format" picks how the positions are stored on the GPU: "float32",
+ * "float16", "snorm16" (normalised to the bounding box) or "auto", the
+ * default, which stores meshes of COMPACT_VERTEX_MIN vertices and more as
+ * snorm16. Normals and colors, three or four per vertex, are always stored
+ * compact; see VertexFormat.
+ *
+ * "type" defaults to "create", which requires every field except vertexData.
+ * "update" and "delete" only require the id; an update carries just the
+ * fields that changed.
+ *
+ * Unknown keys are skipped.
+ */
+
+enum class EntityMessageType
+{
+    Create,
+    Update,
+    Delete,
+};
+
+class EntityMessageDecoder : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+    EntityMessageDecoder(BufferPool<float> *bufferPool = nullptr) : bufferPool(bufferPool) {}
+
+    // Decodes one message, returning false and setting Error() on failure
+    bool Decode(const char *data, std::size_t length, EntityCreationMessageV2 &message);
+    const std::string &Error() const { return error; }
+    // Type of the last decoded message
+    EntityMessageType Type() const { return type; }
+    // True if the last decoded message had a vertexData.positions array
+    bool HasPositions() const { return seenPositions; }
+
+    bool null() override { return scalar(); }
+    bool boolean(bool) override { return scalar(); }
+    bool number_integer(number_integer_t value) override { return number(static_cast<double>(value)); }
+    bool number_unsigned(number_unsigned_t value) override { return number(static_cast<double>(value)); }
+    bool number_float(number_float_t value, const string_t &) override { return number(value); }
+    bool string(string_t &value) override;
+    bool binary(binary_t &) override { return fail("binary values are not supported"); }
+    bool start_object(std::size_t) override;
+    bool key(string_t &value) override;
+    bool end_object() override;
+    bool start_array(std::size_t) override;
+    bool end_array() override;
+    bool parse_error(std::size_t position, const std::string &, const nlohmann::detail::exception &ex) override;
+
+private:
+    enum class Field
+    {
+        None,
+        Type,
+        Id,
+        ShapeType,
+        VertexShader,
+        FragmentShader,
+        UniformType,
+        VertexFormat,
+    };
+
+    BufferPool<float> *bufferPool;
+    EntityCreationMessageV2 *message = nullptr;
+    std::string error;
+
+    // key at each open object level; arrays are tracked by depth only
+    std::vector<std::string> keys;
+    int arrayDepth = 0;
+    std::vector<float> *arrayTarget = nullptr;
+    std::vector<uint32_t> *indexTarget = nullptr; // set instead of arrayTarget inside "indices"
+
+    // uniform currently being read, committed when its object closes
+    std::string uniformType;
+    std::vector<float> uniformValue;
+
+    EntityMessageType type = EntityMessageType::Create;
+    bool seenId = false;
+    bool seenShapeType = false;
+    bool seenPositions = false;
+    std::size_t estimatedFloats = 0;
+
+    void reset(EntityCreationMessageV2 &target, std::size_t length);
+    bool validate();
+    Field scalarField() const;
+    std::vector<float> *arrayField();
+    bool number(double value);
+    bool scalar();
+    bool setId(long long id);
+    bool fail(const std::string &reason);
+    bool path(const char *first, const char *second = nullptr) const;
+};
+
+bool EntityMessageDecoder::Decode(const char *data, std::size_t length, EntityCreationMessageV2 &target)
+{
+    reset(target, length);
+    bool ok = nlohmann::json::sax_parse(data, data + length, this) && validate();
+    message = nullptr;
+    return ok;
+}
+
+void EntityMessageDecoder::reset(EntityCreationMessageV2 &target, std::size_t length)
+{
+    message = &target;
+    error.clear();
+    keys.clear();
+    arrayDepth = 0;
+    arrayTarget = nullptr;
+    indexTarget = nullptr;
+    uniformType.clear();
+    uniformValue.clear();
+    type = EntityMessageType::Create;
+    seenId = false;
+    seenShapeType = false;
+    seenPositions = false;
+    // a typical coordinate takes about 8 bytes of text ("-0.2500,"), so this
+    // roughly sizes the positions array; denser payloads grow it as they parse
+    estimatedFloats = length / 8;
+}
+
+bool EntityMessageDecoder::validate()
+{
+    if (!error.empty())
+        return false;
+    if (!seenId)
+        return fail("missing field: id");
+    if (message->vertexData.positions.size() % 3 != 0)
+        return fail("vertexData.positions must contain xyz triples");
+    if (message->vertexData.indices.size() % 3 != 0)
+        return fail("vertexData.indices must contain triangles");
+    if (!message->vertexData.indices.empty())
+    {
+        // indices replace the geometry together with the positions they point into
+        std::size_t vertexCount = message->vertexData.positions.size() / 3;
+        if (!seenPositions)
+            return fail("vertexData.indices requires vertexData.positions");
+        for (uint32_t index : message->vertexData.indices)
+        {
+            if (index >= vertexCount)
+                return fail("vertexData.indices out of range: " + std::to_string(index));
+        }
+    }
+    if (type != EntityMessageType::Create)
+        return true;
+    if (!seenShapeType)
+        return fail("missing field: shapeType");
+    if (message->transform.position.size() < 3 || message->transform.scale.size() < 3 || message->transform.rotation.size() < 3)
+        return fail("transform requires position, rotation and scale with at least 3 components");
+    if (message->shaders.vertexShader.empty() || message->shaders.fragmentShader.empty())
+        return fail("shaders require vertex and fragment paths");
+    auto color = message->uniforms.floatVecUniforms.find("color");
+    if (color == message->uniforms.floatVecUniforms.end())
+        return fail("missing uniform: color");
+    return true;
+}
+
+bool EntityMessageDecoder::path(const char *first, const char *second) const
+{
+    std::size_t depth = second ? 2 : 1;
+    if (keys.size() != depth || keys[0] != first)
+        return false;
+    return !second || keys[1] == second;
+}
+
+EntityMessageDecoder::Field EntityMessageDecoder::scalarField() const
+{
+    if (path("type"))
+        return Field::Type;
+    if (path("id"))
+        return Field::Id;
+    if (path("shapeType"))
+        return Field::ShapeType;
+    if (path("shaders", "vertex"))
+        return Field::VertexShader;
+    if (path("shaders", "fragment"))
+        return Field::FragmentShader;
+    if (keys.size() == 3 && keys[0] == "uniforms" && keys[2] == "type")
+        return Field::UniformType;
+    if (path("vertexData", "format"))
+        return Field::VertexFormat;
+    return Field::None;
+}
+
+std::vector<float> *EntityMessageDecoder::arrayField()
+{
+    if (path("vertexData", "positions"))
+    {
+        if (bufferPool)
+            message->vertexData.positions = bufferPool->Acquire(estimatedFloats);
+        seenPositions = true;
+        return &message->vertexData.positions;
+    }
+    if (path("vertexData", "normals"))
+        return &message->vertexData.normals;
+    if (path("vertexData", "texCoords"))
+        return &message->vertexData.texCoords;
+    if (path("vertexData", "colors"))
+        return &message->vertexData.colors;
+    if (path("transform", "position"))
+        return &message->transform.position;
+    if (path("transform", "rotation"))
+        return &message->transform.rotation;
+    if (path("transform", "scale"))
+        return &message->transform.scale;
+    if (keys.size() == 3 && keys[0] == "uniforms" && keys[2] == "value")
+        return &uniformValue;
+    return nullptr;
+}
+
+bool EntityMessageDecoder::number(double value)
+{
+    // hot path: elements of a known float array
+    if (arrayTarget)
+    {
+        arrayTarget->push_back(static_cast<float>(value));
+        return true;
+    }
+    if (indexTarget)
+    {
+        if (value < 0.0 || value > 4294967295.0 || value != static_cast<double>(static_cast<uint32_t>(value)))
+            return fail("vertexData.indices must be non-negative integers");
+        indexTarget->push_back(static_cast<uint32_t>(value));
+        return true;
+    }
+    if (arrayDepth == 0 && scalarField() == Field::Id)
+    {
+        // checked before the cast, which is undefined for values outside long long
+        if (value < INT_MIN || value > INT_MAX || value != std::trunc(value))
+        {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%.15g", value);
+            return fail(std::string("id out of range: ") + text);
+        }
+        return setId(static_cast<long long>(value));
+    }
+    return scalar();
+}
+
+bool EntityMessageDecoder::setId(long long id)
+{
+    if (id < INT_MIN || id > INT_MAX)
+        return fail("id out of range: " + std::to_string(id));
+    message->id = static_cast<int>(id);
+    seenId = true;
+    return true;
+}
+
+bool EntityMessageDecoder::scalar()
+{
+    if (arrayTarget || indexTarget)
+        return fail("non-numeric value in " + keys.back());
+    if (arrayDepth == 0 && scalarField() != Field::None)
+        return fail("unexpected value type for " + keys.back());
+    return true;
+}
+
+bool EntityMessageDecoder::string(string_t &value)
+{
+    if (arrayTarget || indexTarget)
+        return fail("non-numeric value in " + keys.back());
+    if (arrayDepth > 0)
+        return true;
+
+    switch (scalarField())
+    {
+    case Field::Id:
+    {
+        char *end = nullptr;
+        errno = 0;
+        long long id = std::strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0')
+            return fail("id is not an integer: " + value);
+        if (errno == ERANGE)
+            return fail("id out of range: " + value);
+        if (!setId(id))
+            return false;
+        break;
+    }
+    case Field::Type:
+        if (value == "create")
+            type = EntityMessageType::Create;
+        else if (value == "update")
+            type = EntityMessageType::Update;
+        else if (value == "delete")
+            type = EntityMessageType::Delete;
+        else
+            return fail("unknown message type: " + value);
+        break;
+    case Field::ShapeType:
+        message->shapeType = std::move(value);
+        seenShapeType = true;
+        break;
+    case Field::VertexShader:
+        message->shaders.vertexShader = std::move(value);
+        break;
+    case Field::FragmentShader:
+        message->shaders.fragmentShader = std::move(value);
+        break;
+    case Field::UniformType:
+        uniformType = std::move(value);
+        break;
+    case Field::VertexFormat:
+        if (value == "auto")
+            message->vertexData.positionFormat = POSITION_FORMAT_AUTO;
+        else if (value == "float32")
+            message->vertexData.positionFormat = POSITION_FORMAT_FLOAT32;
+        else if (value == "float16")
+            message->vertexData.positionFormat = POSITION_FORMAT_FLOAT16;
+        else if (value == "snorm16")
+            message->vertexData.positionFormat = POSITION_FORMAT_SNORM16;
+        else
+            return fail("unknown vertexData.format: " + value);
+        break;
+    case Field::None:
+        break;
+    }
+    return true;
+}
+
+bool EntityMessageDecoder::start_object(std::size_t)
+{
+    if (arrayTarget || indexTarget)
+        return fail("unexpected object in " + keys.back());
+    if (arrayDepth > 0)
+    {
+        // objects nested in unknown arrays are skipped wholesale
+        ++arrayDepth;
+        return true;
+    }
+    keys.emplace_back();
+    return true;
+}
+
+bool EntityMessageDecoder::key(string_t &value)
+{
+    if (arrayDepth == 0 && !keys.empty())
+        keys.back() = std::move(value);
+    return true;
+}
+
+bool EntityMessageDecoder::end_object()
+{
+    if (arrayDepth > 0)
+    {
+        --arrayDepth;
+        return true;
+    }
+    // closing "uniforms": { "<name>": { ... } }
+    if (keys.size() == 3 && keys[0] == "uniforms")
+    {
+        if (uniformType == "floatVecUniforms" && uniformValue.size() >= 4)
+        {
+            message->uniforms.floatVecUniforms[keys[1]] = std::move(uniformValue);
+        }
+        uniformType.clear();
+        uniformValue.clear();
+    }
+    keys.pop_back();
+    return true;
+}
+
+bool EntityMessageDecoder::start_array(std::size_t)
+{
+    if (arrayTarget || indexTarget)
+        return fail("nested array in " + keys.back());
+    if (arrayDepth == 0)
+    {
+        arrayTarget = arrayField();
+        if (arrayTarget && arrayTarget != &message->vertexData.positions)
+            arrayTarget->clear();
+        if (!arrayTarget && path("vertexData", "indices"))
+        {
+            indexTarget = &message->vertexData.indices;
+            indexTarget->clear();
+        }
+    }
+    ++arrayDepth;
+    return true;
+}
+
+bool EntityMessageDecoder::end_array()
+{
+    --arrayDepth;
+    if (arrayDepth == 0)
+    {
+        arrayTarget = nullptr;
+        indexTarget = nullptr;
+    }
+    return true;
+}
+
+bool EntityMessageDecoder::parse_error(std::size_t position, const std::string &, const nlohmann::detail::exception &ex)
+{
+    return fail("byte " + std::to_string(position) + ": " + ex.what());
+}
+
+bool EntityMessageDecoder::fail(const std::string &reason)
+{
+    if (error.empty())
+        error = reason;
+    return false;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include "EntityCreationMessageV2.h"
+
+enum EntityUpdateField : uint32_t
+{
+    UPDATE_POSITION = 1 << 0,
+    UPDATE_ROTATION = 1 << 1,
+    UPDATE_SCALE = 1 << 2,
+    UPDATE_COLOR = 1 << 3,
+    UPDATE_GEOMETRY = 1 << 4,
+
+    UPDATE_TRANSFORM = UPDATE_POSITION | UPDATE_ROTATION | UPDATE_SCALE,
+};
+
+// Partial update of an existing V2 entity addressed by its external id. Only
+// the members named in fields carry data; the rest are left empty.
+struct EntityUpdateMessage
+{
+    int id = 0;
+    uint32_t fields = 0;
+    Transform transform;
+    UniformData uniforms;
+    VertexData vertexData;
+    PreparedMesh mesh; // vertexData interleaved off the render thread, once ready
+    uint64_t sequence = 0; // ingest order, stamped by IngestBatch
+
+    bool Has(uint32_t field) const { return (fields & field) != 0; }
+
+    EntityUpdateMessage() {}
+
+    // Builds an update from a decoded message, treating every field it carries as changed
+    static EntityUpdateMessage FromPartial(EntityCreationMessageV2 &&message, bool hasGeometry)
+    {
+        EntityUpdateMessage update;
+        update.id = message.id;
+        if (message.transform.position.size() >= 3)
+            update.fields |= UPDATE_POSITION;
+        if (message.transform.rotation.size() >= 3)
+            update.fields |= UPDATE_ROTATION;
+        if (message.transform.scale.size() >= 3)
+            update.fields |= UPDATE_SCALE;
+        if (message.uniforms.floatVecUniforms.count("color"))
+            update.fields |= UPDATE_COLOR;
+        if (hasGeometry)
+            update.fields |= UPDATE_GEOMETRY;
+
+        update.transform = std::move(message.transform);
+        update.uniforms = std::move(message.uniforms);
+        update.vertexData = std::move(message.vertexData);
+        update.mesh = std::move(message.mesh);
+        return update;
+    }
+};
@@ -0,0 +1,149 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+ * JsonDocumentSplitter finds the boundaries of top-level json objects in a
+ * byte stream that arrives in arbitrary chunks. It accepts either a single
+ * json array of objects or a sequence of objects separated by whitespace
+ * (NDJSON), so request bodies can be decoded object by object while they are
+ * still being read instead of after the whole body has been buffered.
+ *
+ * Only the unfinished tail of the stream is kept between calls to Feed, and
+ * an object longer than maxDocumentLength fails the stream instead of being
+ * buffered without bound.
+ */
+
+class JsonDocumentSplitter
+{
+public:
+    explicit JsonDocumentSplitter(std::size_t maxDocumentLength) : maxDocumentLength(maxDocumentLength) {}
+
+    // Feeds the next chunk, calling onDocument(const char *data, size_t length)
+    // for every complete top-level object. Returns false on malformed framing.
+    template <typename Callback>
+    bool Feed(const char *data, std::size_t length, Callback &&onDocument);
+
+    // True once the stream ended cleanly: no partial object or open array
+    bool Finished() const { return error.empty() && depth == 0 && !inArray; }
+    const std::string &Error() const { return error; }
+
+private:
+    std::size_t maxDocumentLength;
+    std::string pending;    // bytes of the object currently being scanned
+    int depth = 0;          // nesting depth inside the current object
+    bool inString = false;
+    bool escaped = false;
+    bool inArray = false;   // inside a top-level [ ... ]
+    bool arrayClosed = false;
+    bool expectComma = false;
+    std::string error;
+
+    bool fail(const std::string &reason);
+};
+
+template <typename Callback>
+bool JsonDocumentSplitter::Feed(const char *data, std::size_t length, Callback &&onDocument)
+{
+    if (!error.empty())
+        return false;
+
+    // start of an object inside this chunk, or -1 if it began in an earlier chunk
+    long objectStart = depth > 0 ? -1 : 0;
+
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        char c = data[i];
+
+        if (depth > 0)
+        {
+            if (inString)
+            {
+                if (escaped)
+                    escaped = false;
+                else if (c == '\\')
+                    escaped = true;
+                else if (c == '"')
+                    inString = false;
+                continue;
+            }
+
+            if (c == '"')
+                inString = true;
+            else if (c == '{' || c == '[')
+                ++depth;
+            else if (c == '}' || c == ']')
+            {
+                if (--depth == 0)
+                {
+                    std::size_t documentLength = objectStart < 0 ? pending.size() + i + 1 : i + 1 - objectStart;
+                    if (documentLength > maxDocumentLength)
+                        return fail("oversized document");
+                    if (objectStart < 0)
+                    {
+                        pending.append(data, i + 1);
+                        onDocument(pending.data(), pending.size());
+                        pending.clear();
+                    }
+                    else
+                    {
+                        onDocument(data + objectStart, i + 1 - objectStart);
+                    }
+                    expectComma = inArray;
+                }
+            }
+            continue;
+        }
+
+        // between top-level objects
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            continue;
+        if (arrayClosed)
+            return fail("unexpected data after closing ]");
+
+        if (c == '{')
+        {
+            if (expectComma)
+                return fail("expected , between array elements");
+            depth = 1;
+            objectStart = static_cast<long>(i);
+        }
+        else if (c == '[' && !inArray && !expectComma)
+        {
+            inArray = true;
+        }
+        else if (c == ',' && inArray && expectComma)
+        {
+            expectComma = false;
+        }
+        else if (c == ']' && inArray)
+        {
+            inArray = false;
+            arrayClosed = true;
+            expectComma = false;
+        }
+        else
+        {
+            return fail(std::string("unexpected character '") + c + "' between documents");
+        }
+    }
+
+    // keep the unfinished object for the next chunk
+    if (depth > 0)
+    {
+        if (objectStart < 0)
+            pending.append(data, length);
+        else
+            pending.assign(data + objectStart, length - objectStart);
+        if (pending.size() > maxDocumentLength)
+            return fail("oversized document");
+    }
+    return true;
+}
+
+bool JsonDocumentSplitter::fail(const std::string &reason)
+{
+    if (error.empty())
+        error = reason;
+    return false;
+}
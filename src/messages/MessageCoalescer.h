@@ -0,0 +1,227 @@
+#pragma once
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "QueueCollection.h"
+
+/**
+ * MessageCoalescer drains the V2 creation, update and deletion queues once per
+ * frame and folds everything pending for an external id into one net
+ * operation, so the ECS never builds an entity that a later message in the
+ * same frame replaces or deletes.
+ *
+ * Messages are replayed in their ingest sequence order:
+ *   create          replaces whatever was pending for the id
+ *   update          merges into the pending create or update, last write
+ *                   wins per field; dropped if the id is pending deletion
+ *   delete          replaces a pending create or update
+ *
+ * Every id ends up in exactly one of Creations(), Updates() or Deletions().
+ */
+class MessageCoalescer
+{
+public:
+    MessageCoalescer(QueueCollection &queues) : queues(queues) {}
+
+    // Drains the queues and folds their contents; returns the net operation count
+    size_t Drain();
+
+    std::vector<EntityCreationMessageV2> &Creations() { return netCreations; }
+    std::vector<EntityUpdateMessage> &Updates() { return netUpdates; }
+    std::vector<EntityDeletionMessage> &Deletions() { return netDeletions; }
+
+private:
+    enum class Kind
+    {
+        Create,
+        Update,
+        Delete,
+    };
+
+    struct Pending
+    {
+        uint64_t sequence;
+        Kind kind;
+        size_t index;
+    };
+
+    QueueCollection &queues;
+
+    // everything drained this frame, indexed by Pending
+    std::vector<EntityCreationMessageV2> creations;
+    std::vector<EntityUpdateMessage> updates;
+    std::vector<EntityDeletionMessage> deletions;
+    std::vector<Pending> pending;
+
+    // net operation per id, and ids in the order they were first seen
+    std::unordered_map<int, Pending> net;
+    std::vector<int> order;
+
+    std::vector<EntityCreationMessageV2> netCreations;
+    std::vector<EntityUpdateMessage> netUpdates;
+    std::vector<EntityDeletionMessage> netDeletions;
+
+    int idOf(const Pending &message) const;
+    void fold(const Pending &message);
+    void release(const Pending &message);
+    void mergeUpdate(Transform &transform, UniformData &uniforms, VertexData &vertexData, PreparedMesh &mesh, EntityUpdateMessage &update);
+
+    template <typename T>
+    static void drainQueue(ConcurrentQueue<std::vector<T>> &queue, std::vector<T> &out);
+};
+
+template <typename T>
+void MessageCoalescer::drainQueue(ConcurrentQueue<std::vector<T>> &queue, std::vector<T> &out)
+{
+    std::vector<T> messages;
+    while (queue.TryPop(messages))
+    {
+        if (out.empty())
+        {
+            out = std::move(messages);
+            continue;
+        }
+        out.insert(out.end(), std::make_move_iterator(messages.begin()), std::make_move_iterator(messages.end()));
+    }
+}
+
+size_t MessageCoalescer::Drain()
+{
+    creations.clear();
+    updates.clear();
+    deletions.clear();
+    netCreations.clear();
+    netUpdates.clear();
+    netDeletions.clear();
+
+    drainQueue(queues.entityCreationV2Queue, creations);
+    drainQueue(queues.entityUpdateQueue, updates);
+    drainQueue(queues.entityDeletionQueue, deletions);
+
+    pending.clear();
+    for (size_t i = 0; i < creations.size(); ++i)
+        pending.push_back({creations[i].sequence, Kind::Create, i});
+    for (size_t i = 0; i < updates.size(); ++i)
+        pending.push_back({updates[i].sequence, Kind::Update, i});
+    for (size_t i = 0; i < deletions.size(); ++i)
+        pending.push_back({deletions[i].sequence, Kind::Delete, i});
+    std::sort(pending.begin(), pending.end(), [](const Pending &a, const Pending &b)
+              { return a.sequence < b.sequence; });
+
+    net.clear();
+    order.clear();
+    for (const Pending &message : pending)
+    {
+        fold(message);
+    }
+
+    for (int id : order)
+    {
+        const Pending &message = net.at(id);
+        switch (message.kind)
+        {
+        case Kind::Create:
+            netCreations.push_back(std::move(creations[message.index]));
+            break;
+        case Kind::Update:
+            netUpdates.push_back(std::move(updates[message.index]));
+            break;
+        case Kind::Delete:
+            netDeletions.push_back(deletions[message.index]);
+            break;
+        }
+    }
+
+    uint64_t coalesced = pending.size() - order.size();
+    queues.ingestStats.messagesCoalesced.fetch_add(coalesced, std::memory_order_relaxed);
+    queues.ingestStats.lastFrameCoalesced.store(coalesced, std::memory_order_relaxed);
+    return order.size();
+}
+
+int MessageCoalescer::idOf(const Pending &message) const
+{
+    switch (message.kind)
+    {
+    case Kind::Create:
+        return creations[message.index].id;
+    case Kind::Update:
+        return updates[message.index].id;
+    case Kind::Delete:
+    default:
+        return deletions[message.index].id;
+    }
+}
+
+void MessageCoalescer::fold(const Pending &message)
+{
+    int id = idOf(message);
+    auto [it, inserted] = net.emplace(id, message);
+    if (inserted)
+    {
+        order.push_back(id);
+        return;
+    }
+
+    Pending &current = it->second;
+    switch (message.kind)
+    {
+    case Kind::Create:
+        release(current);
+        current = message;
+        break;
+
+    case Kind::Update:
+    {
+        EntityUpdateMessage &update = updates[message.index];
+        if (current.kind == Kind::Create)
+        {
+            EntityCreationMessageV2 &creation = creations[current.index];
+            mergeUpdate(creation.transform, creation.uniforms, creation.vertexData, creation.mesh, update);
+        }
+        else if (current.kind == Kind::Update)
+        {
+            EntityUpdateMessage &target = updates[current.index];
+            mergeUpdate(target.transform, target.uniforms, target.vertexData, target.mesh, update);
+            target.fields |= update.fields;
+        }
+        ReleaseVertexData(queues.floatBufferPool, update.vertexData);
+        break;
+    }
+
+    case Kind::Delete:
+        if (current.kind == Kind::Create)
+        {
+            queues.ingestStats.creationsCancelled.fetch_add(1, std::memory_order_relaxed);
+        }
+        release(current);
+        current = message;
+        break;
+    }
+}
+
+// Applies the fields of update onto a pending message for the same id
+void MessageCoalescer::mergeUpdate(Transform &transform, UniformData &uniforms, VertexData &vertexData, PreparedMesh &mesh, EntityUpdateMessage &update)
+{
+    if (update.Has(UPDATE_POSITION))
+        transform.position = std::move(update.transform.position);
+    if (update.Has(UPDATE_ROTATION))
+        transform.rotation = std::move(update.transform.rotation);
+    if (update.Has(UPDATE_SCALE))
+        transform.scale = std::move(update.transform.scale);
+    if (update.Has(UPDATE_COLOR))
+        uniforms.floatVecUniforms["color"] = std::move(update.uniforms.floatVecUniforms.at("color"));
+    if (update.Has(UPDATE_GEOMETRY))
+    {
+        // the superseded buffers are released with the update
+        std::swap(vertexData, update.vertexData);
+        std::swap(mesh, update.mesh);
+    }
+}
+
+void MessageCoalescer::release(const Pending &message)
+{
+    if (message.kind == Kind::Create)
+        ReleaseVertexData(queues.floatBufferPool, creations[message.index].vertexData);
+    else if (message.kind == Kind::Update)
+        ReleaseVertexData(queues.floatBufferPool, updates[message.index].vertexData);
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "VertexFormat.h"
+#include "IndexedGeometry.h"
+
+// Vertex data interleaved into the VertexFormat the render thread uploads,
+// welded into unique vertices and indices, with its object space bounds.
+// Filled off the render thread by MeshPipeline.
+struct PreparedMesh
+{
+    std::vector<unsigned char> vertices; // vertexCount vertices of VertexFormat::Get(format)
+    uint32_t vertexCount = 0;
+    uint8_t format = 0;
+    PositionDecode decode;         // from the stored positions back to object space
+    std::vector<uint32_t> indices; // empty when the mesh is drawn non-indexed
+    size_t weldedVertices = 0;     // vertices removed by welding
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    uint64_t contentHash = 0; // key into the GeometryCache, never zero once ready
+    bool ready = false;
+
+    // GPU bytes of the mesh as stored, with every triangle corner as its own
+    // vertex, and with its vertices as plain floats
+    size_t Bytes() const { return vertices.size() + indices.size() * IndexBytes(vertexCount); }
+    size_t NonIndexedBytes() const { return (indices.empty() ? vertexCount : indices.size()) * VertexFormat::Get(format).stride; }
+    size_t FloatVertexBytes() const { return static_cast<size_t>(vertexCount) * VertexFormat::Get(format).FloatStride(); }
+};
+
+// Hashes bytes eight at a time, continuing from seed
+inline uint64_t HashBytes(const void *data, size_t length, uint64_t seed = 0xcbf29ce484222325ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+    uint64_t hash = seed ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < length; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash ? hash : 1;
+}
+
+// Hashes the format, the vertex bytes with their decode and the indices
+inline uint64_t HashMesh(uint8_t format, const PositionDecode &decode, const std::vector<unsigned char> &vertices,
+                         const std::vector<uint32_t> &indices)
+{
+    uint64_t hash = HashBytes(vertices.data(), vertices.size(), 0xcbf29ce484222325ull ^ format);
+    if (!decode.IsIdentity())
+        hash = HashBytes(&decode, sizeof(decode), hash);
+    if (!indices.empty())
+        hash = HashBytes(indices.data(), indices.size() * sizeof(uint32_t), hash);
+    return hash;
+}
+
+/**
+ * Interleaves positions and, when there is one per vertex, texCoords (2
+ * floats), normals (3) and colors (3 or 4) into the format ChooseVertexFormat
+ * picks for positionFormat, welds identical vertices, computes the bounding
+ * box and hashes the result. indices, if any, have been checked against the
+ * vertex count.
+ */
+inline void PrepareMesh(const std::vector<float> &positions, const std::vector<float> &texCoords, const std::vector<float> &normals,
+                        const std::vector<float> &colors, const std::vector<uint32_t> &indices, PositionFormat positionFormat,
+                        PreparedMesh &mesh)
+{
+    size_t vertexCount = positions.size() / 3;
+    bool hasTexCoords = vertexCount > 0 && texCoords.size() == vertexCount * 2;
+    bool hasNormals = vertexCount > 0 && normals.size() == vertexCount * 3;
+    size_t colorChannels = vertexCount > 0 && colors.size() % vertexCount == 0 ? colors.size() / vertexCount : 0;
+    bool hasColors = colorChannels == 3 || colorChannels == 4;
+
+    glm::vec3 low(0.0f), high(0.0f);
+    if (vertexCount > 0)
+    {
+        low = high = glm::vec3(positions[0], positions[1], positions[2]);
+    }
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        glm::vec3 position(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+        low = glm::min(low, position);
+        high = glm::max(high, position);
+    }
+
+    mesh.format = ChooseVertexFormat(positionFormat, vertexCount, low, high, hasTexCoords ? texCoords.data() : nullptr, hasNormals, hasColors);
+    const VertexFormat &format = VertexFormat::Get(mesh.format);
+    mesh.decode = MakePositionDecode(format.Positions(), low, high);
+    EncodeVertices(format, vertexCount, positions.data(), texCoords.data(), normals.data(), colors.data(), colorChannels, mesh.decode,
+                   mesh.vertices);
+
+    mesh.indices = indices;
+    mesh.weldedVertices = WeldVertices(mesh.vertices, format.stride, mesh.indices);
+    mesh.vertexCount = static_cast<uint32_t>(mesh.vertices.size() / format.stride);
+
+    mesh.boundsMin = low;
+    mesh.boundsMax = high;
+    mesh.contentHash = HashMesh(mesh.format, mesh.decode, mesh.vertices, mesh.indices);
+    mesh.ready = true;
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <glad.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "IngestStats.h"
+#include "FrameCapture.h"
+
+/**
+ * FrameReadback reads rendered frames back without stalling the pipeline.
+ * Capture starts an asynchronous glReadPixels of the bound read framebuffer
+ * into one of BUFFERS pixel buffer objects and fences it; the pixels are
+ * mapped frames later, once the fence has signalled, so frame N is copied
+ * out while N+1 renders. When every buffer is still in flight the frame is
+ * skipped rather than waited for.
+ *
+ * Owned by the render thread.
+ */
+class FrameReadback
+{
+public:
+    static constexpr size_t BUFFERS = 3;
+
+    FrameReadback(IngestStats &stats) : stats(stats) {}
+    ~FrameReadback();
+
+    FrameReadback(const FrameReadback &) = delete;
+    FrameReadback &operator=(const FrameReadback &) = delete;
+
+    // Hands finished readbacks to capture and, if it wants one, starts reading
+    // back the width x height frame just drawn. Call once per frame, before the swap
+    void Capture(FrameCapture &capture, int width, int height);
+
+private:
+    struct Slot
+    {
+        GLuint buffer = 0;
+        size_t capacity = 0;
+        GLsync fence = nullptr;
+        int width = 0;
+        int height = 0;
+        uint64_t frame = 0;
+        int64_t issuedAt = 0;
+    };
+
+    IngestStats &stats;
+    std::array<Slot, BUFFERS> slots;
+    size_t next = 0; // the slot written next, and the oldest in flight
+    uint64_t frame = 0;
+
+    int64_t rateWindowStart = 0;
+    uint64_t rateWindowReadbacks = 0;
+
+    void collect(FrameCapture &capture, int64_t now);
+    bool finish(FrameCapture &capture, Slot &slot, int64_t now);
+};
+
+FrameReadback::~FrameReadback()
+{
+    for (Slot &slot : slots)
+    {
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        if (slot.buffer)
+            glDeleteBuffers(1, &slot.buffer);
+    }
+}
+
+void FrameReadback::Capture(FrameCapture &capture, int width, int height)
+{
+    ++frame;
+    int64_t now = IngestStats::NowNanoseconds();
+    collect(capture, now);
+    if (width <= 0 || height <= 0 || !capture.Wanted(now))
+        return;
+
+    Slot &slot = slots[next];
+    if (slot.fence)
+    {
+        stats.frameReadbackDrops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    size_t bytes = static_cast<size_t>(width) * height * 4;
+    if (slot.buffer == 0)
+        glGenBuffers(1, &slot.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.capacity != bytes)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        slot.capacity = bytes;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.width = width;
+    slot.height = height;
+    slot.frame = frame;
+    slot.issuedAt = now;
+    next = (next + 1) % BUFFERS;
+}
+
+// Finishes the readbacks whose fences have signalled, oldest first, stopping
+// at the first still in flight so frames reach capture in order
+void FrameReadback::collect(FrameCapture &capture, int64_t now)
+{
+    for (size_t i = 0; i < BUFFERS; ++i)
+    {
+        Slot &slot = slots[(next + i) % BUFFERS];
+        if (slot.fence && !finish(capture, slot, now))
+            break;
+    }
+
+    if (now - rateWindowStart >= 1000000000)
+    {
+        stats.frameReadbacksLastSecond.store(rateWindowReadbacks, std::memory_order_relaxed);
+        rateWindowStart = now;
+        rateWindowReadbacks = 0;
+    }
+}
+
+bool FrameReadback::finish(FrameCapture &capture, Slot &slot, int64_t now)
+{
+    if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        return false;
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    size_t rowBytes = static_cast<size_t>(slot.width) * 4;
+    size_t bytes = rowBytes * slot.height;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const unsigned char *pixels = static_cast<const unsigned char *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+    if (pixels)
+    {
+        // GL rows run bottom-up
+        std::vector<unsigned char> rgba(bytes);
+        for (int y = 0; y < slot.height; ++y)
+            std::memcpy(rgba.data() + y * rowBytes, pixels + (slot.height - 1 - y) * rowBytes, rowBytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        capture.Submit(slot.width, slot.height, std::move(rgba));
+
+        uint64_t latency = static_cast<uint64_t>(now - slot.issuedAt);
+        stats.framesReadBack.fetch_add(1, std::memory_order_relaxed);
+        stats.frameReadbackBytes.fetch_add(bytes, std::memory_order_relaxed);
+        stats.frameReadbackNanoseconds.fetch_add(latency, std::memory_order_relaxed);
+        stats.lastFrameReadbackNanoseconds.store(latency, std::memory_order_relaxed);
+        stats.lastFrameReadbackFrames.store(frame - slot.frame, std::memory_order_relaxed);
+        ++rateWindowReadbacks;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
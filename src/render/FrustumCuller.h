@@ -0,0 +1,152 @@
+#pragma once
+#include <glm.hpp>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FRUSTUM_CULLER_SSE 1
+#endif
+
+/**
+ * FrustumCuller tests bounding volumes against the six planes of a
+ * view-projection matrix. Bounds are gathered structure-of-arrays with Add and
+ * tested four at a time with SSE; other targets use the scalar loop.
+ *
+ * Each volume is an axis aligned box (center, extents) plus a bounding sphere
+ * around the same center. Against each plane the tighter of the two is used,
+ * so a rotated box whose sphere is smaller than its box is culled as early as
+ * the sphere allows.
+ */
+class FrustumCuller
+{
+public:
+    // Extracts the planes of the frustum clip = viewProjection * world (Gribb & Hartmann)
+    void SetFrustum(const glm::mat4 &viewProjection);
+
+    void Clear();
+    void Add(const glm::vec3 &center, const glm::vec3 &extents, float radius);
+    size_t Size() const { return radius.size(); }
+
+    // Writes 1 for every volume at least partly inside the frustum and 0 for the
+    // rest; returns the number inside
+    size_t Test(std::vector<uint8_t> &visible);
+
+private:
+    std::array<glm::vec4, 6> planes; // xyz normal, w distance; inside when dot(n, p) + w >= 0
+
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<float> radius;
+
+    bool testOne(size_t i) const;
+};
+
+void FrustumCuller::SetFrustum(const glm::mat4 &viewProjection)
+{
+    // rows of the matrix; glm stores columns
+    glm::vec4 row[4];
+    for (int r = 0; r < 4; ++r)
+        row[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+
+    planes[0] = row[3] + row[0]; // left
+    planes[1] = row[3] - row[0]; // right
+    planes[2] = row[3] + row[1]; // bottom
+    planes[3] = row[3] - row[1]; // top
+    planes[4] = row[3] + row[2]; // near
+    planes[5] = row[3] - row[2]; // far
+    for (glm::vec4 &plane : planes)
+    {
+        float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f)
+            plane /= length;
+    }
+}
+
+void FrustumCuller::Clear()
+{
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    extentX.clear();
+    extentY.clear();
+    extentZ.clear();
+    radius.clear();
+}
+
+void FrustumCuller::Add(const glm::vec3 &center, const glm::vec3 &extents, float sphereRadius)
+{
+    centerX.push_back(center.x);
+    centerY.push_back(center.y);
+    centerZ.push_back(center.z);
+    extentX.push_back(extents.x);
+    extentY.push_back(extents.y);
+    extentZ.push_back(extents.z);
+    radius.push_back(sphereRadius);
+}
+
+bool FrustumCuller::testOne(size_t i) const
+{
+    for (const glm::vec4 &plane : planes)
+    {
+        float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+        float boxReach = std::fabs(plane.x) * extentX[i] + std::fabs(plane.y) * extentY[i] + std::fabs(plane.z) * extentZ[i];
+        if (distance + std::fmin(boxReach, radius[i]) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+size_t FrustumCuller::Test(std::vector<uint8_t> &visible)
+{
+    size_t count = Size();
+    visible.resize(count);
+    size_t inside = 0;
+    size_t i = 0;
+
+#ifdef FRUSTUM_CULLER_SSE
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&centerX[i]);
+        __m128 cy = _mm_loadu_ps(&centerY[i]);
+        __m128 cz = _mm_loadu_ps(&centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&extentX[i]);
+        __m128 ey = _mm_loadu_ps(&extentY[i]);
+        __m128 ez = _mm_loadu_ps(&extentZ[i]);
+        __m128 r = _mm_loadu_ps(&radius[i]);
+
+        __m128 outside = _mm_setzero_ps();
+        for (const glm::vec4 &plane : planes)
+        {
+            __m128 nx = _mm_set1_ps(plane.x);
+            __m128 ny = _mm_set1_ps(plane.y);
+            __m128 nz = _mm_set1_ps(plane.z);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                                         _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+            __m128 boxReach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex),
+                                                    _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)),
+                                         _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+            __m128 reach = _mm_min_ps(boxReach, r);
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+        }
+
+        int mask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint8_t in = (mask >> lane) & 1 ? 0 : 1;
+            visible[i + lane] = in;
+            inside += in;
+        }
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        visible[i] = testOne(i) ? 1 : 0;
+        inside += visible[i];
+    }
+    return inside;
+}
@@ -0,0 +1,279 @@
+#pragma once
+#include <glad.h>
+#include <dlfcn.h>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * HeadlessContext creates a GL 3.3 core context without a window or display
+ * server, for render nodes and CI. It tries EGL first, on Mesa's surfaceless
+ * platform when available and the default display otherwise, and falls back
+ * to OSMesa. Both work on Mesa llvmpipe.
+ *
+ * The libraries are opened at runtime, so builds and windowed runs need
+ * neither. Nothing is drawn to the context's own surface: OpenGLApp renders
+ * into an OffscreenFramebuffer.
+ *
+ * One context per process, owned by the render thread.
+ */
+class HeadlessContext
+{
+public:
+    HeadlessContext() = default;
+    ~HeadlessContext() { Destroy(); }
+
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+    // Creates the context and makes it current. Returns false if no backend works
+    bool Create();
+    void Destroy();
+
+    const char *Backend() const { return backend; }
+
+    // Loader for gladLoadGLLoader and the extension entry points
+    static void *GetProcAddress(const char *name);
+
+private:
+    // the EGL and OSMesa declarations used, as their headers are not vendored
+    typedef void *EGLDisplay;
+    typedef void *EGLConfig;
+    typedef void *EGLContext;
+    typedef void *EGLSurface;
+    typedef int32_t EGLint;
+    typedef unsigned int EGLBoolean;
+    typedef void *(*EGLGetProcAddressProc)(const char *name);
+    typedef EGLDisplay (*EGLGetDisplayProc)(void *nativeDisplay);
+    typedef EGLDisplay (*EGLGetPlatformDisplayProc)(unsigned int platform, void *nativeDisplay, const EGLint *attributes);
+    typedef EGLBoolean (*EGLInitializeProc)(EGLDisplay display, EGLint *major, EGLint *minor);
+    typedef const char *(*EGLQueryStringProc)(EGLDisplay display, EGLint name);
+    typedef EGLBoolean (*EGLBindAPIProc)(unsigned int api);
+    typedef EGLBoolean (*EGLChooseConfigProc)(EGLDisplay display, const EGLint *attributes, EGLConfig *configs, EGLint size,
+                                              EGLint *count);
+    typedef EGLContext (*EGLCreateContextProc)(EGLDisplay display, EGLConfig config, EGLContext share, const EGLint *attributes);
+    typedef EGLSurface (*EGLCreatePbufferSurfaceProc)(EGLDisplay display, EGLConfig config, const EGLint *attributes);
+    typedef EGLBoolean (*EGLMakeCurrentProc)(EGLDisplay display, EGLSurface draw, EGLSurface read, EGLContext context);
+    typedef EGLBoolean (*EGLDestroySurfaceProc)(EGLDisplay display, EGLSurface surface);
+    typedef EGLBoolean (*EGLDestroyContextProc)(EGLDisplay display, EGLContext context);
+    typedef EGLBoolean (*EGLTerminateProc)(EGLDisplay display);
+
+    static constexpr EGLint EGL_NONE_ = 0x3038;
+    static constexpr EGLint EGL_EXTENSIONS_ = 0x3055;
+    static constexpr EGLint EGL_SURFACE_TYPE_ = 0x3033;
+    static constexpr EGLint EGL_PBUFFER_BIT_ = 0x0001;
+    static constexpr EGLint EGL_RENDERABLE_TYPE_ = 0x3040;
+    static constexpr EGLint EGL_OPENGL_BIT_ = 0x0008;
+    static constexpr EGLint EGL_RED_SIZE_ = 0x3024;
+    static constexpr EGLint EGL_GREEN_SIZE_ = 0x3023;
+    static constexpr EGLint EGL_BLUE_SIZE_ = 0x3022;
+    static constexpr EGLint EGL_DEPTH_SIZE_ = 0x3025;
+    static constexpr EGLint EGL_WIDTH_ = 0x3057;
+    static constexpr EGLint EGL_HEIGHT_ = 0x3056;
+    static constexpr unsigned int EGL_OPENGL_API_ = 0x30A2;
+    static constexpr EGLint EGL_CONTEXT_MAJOR_VERSION_ = 0x3098;
+    static constexpr EGLint EGL_CONTEXT_MINOR_VERSION_ = 0x30FB;
+    static constexpr EGLint EGL_CONTEXT_OPENGL_PROFILE_MASK_ = 0x30FD;
+    static constexpr EGLint EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_ = 0x0001;
+    static constexpr unsigned int EGL_PLATFORM_SURFACELESS_MESA_ = 0x31DD;
+
+    typedef void *OSMesaContext;
+    typedef OSMesaContext (*OSMesaCreateContextAttribsProc)(const int *attributes, OSMesaContext share);
+    typedef GLboolean (*OSMesaMakeCurrentProc)(OSMesaContext context, void *buffer, GLenum type, GLsizei width, GLsizei height);
+    typedef void (*OSMesaDestroyContextProc)(OSMesaContext context);
+    typedef void *(*OSMesaGetProcAddressProc)(const char *name);
+
+    static constexpr int OSMESA_FORMAT_ = 0x22;
+    static constexpr int OSMESA_RGBA_ = 0x1908;
+    static constexpr int OSMESA_DEPTH_BITS_ = 0x30;
+    static constexpr int OSMESA_PROFILE_ = 0x33;
+    static constexpr int OSMESA_CORE_PROFILE_ = 0x34;
+    static constexpr int OSMESA_CONTEXT_MAJOR_VERSION_ = 0x36;
+    static constexpr int OSMESA_CONTEXT_MINOR_VERSION_ = 0x37;
+
+    const char *backend = "none";
+    void *library = nullptr;
+
+    EGLDisplay eglDisplay = nullptr;
+    EGLContext eglContext = nullptr;
+    EGLSurface eglSurface = nullptr;
+
+    OSMesaContext osMesaContext = nullptr;
+    std::vector<unsigned char> osMesaBuffer; // the context's own 1x1 surface
+
+    static inline void *(*procAddress)(const char *name) = nullptr;
+
+    bool createEGL();
+    bool createOSMesa();
+    template <typename Proc>
+    Proc symbol(const char *name) const { return reinterpret_cast<Proc>(dlsym(library, name)); }
+};
+
+bool HeadlessContext::Create()
+{
+    if (createEGL() || createOSMesa())
+    {
+        std::cout << "Headless " << backend << " context created" << std::endl;
+        return true;
+    }
+    std::cerr << "Failed to create a headless GL context with EGL or OSMesa" << std::endl;
+    return false;
+}
+
+bool HeadlessContext::createEGL()
+{
+    library = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!library)
+        return false;
+
+    auto getProcAddress = symbol<EGLGetProcAddressProc>("eglGetProcAddress");
+    auto getDisplay = symbol<EGLGetDisplayProc>("eglGetDisplay");
+    auto initialize = symbol<EGLInitializeProc>("eglInitialize");
+    auto queryString = symbol<EGLQueryStringProc>("eglQueryString");
+    auto bindAPI = symbol<EGLBindAPIProc>("eglBindAPI");
+    auto chooseConfig = symbol<EGLChooseConfigProc>("eglChooseConfig");
+    auto createContext = symbol<EGLCreateContextProc>("eglCreateContext");
+    auto createPbufferSurface = symbol<EGLCreatePbufferSurfaceProc>("eglCreatePbufferSurface");
+    auto makeCurrent = symbol<EGLMakeCurrentProc>("eglMakeCurrent");
+    auto terminate = symbol<EGLTerminateProc>("eglTerminate");
+    if (!getProcAddress || !getDisplay || !initialize || !queryString || !bindAPI || !chooseConfig || !createContext ||
+        !createPbufferSurface || !makeCurrent || !terminate)
+    {
+        dlclose(library);
+        library = nullptr;
+        return false;
+    }
+
+    // the surfaceless platform needs neither X, Wayland nor a DRM device
+    const char *clientExtensions = queryString(nullptr, EGL_EXTENSIONS_);
+    auto getPlatformDisplay = reinterpret_cast<EGLGetPlatformDisplayProc>(getProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay && clientExtensions && std::strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+    {
+        eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA_, nullptr, nullptr);
+        if (eglDisplay && !initialize(eglDisplay, nullptr, nullptr))
+            eglDisplay = nullptr;
+    }
+    if (!eglDisplay)
+    {
+        eglDisplay = getDisplay(nullptr);
+        if (eglDisplay && !initialize(eglDisplay, nullptr, nullptr))
+            eglDisplay = nullptr;
+    }
+
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    if (eglDisplay && bindAPI(EGL_OPENGL_API_))
+    {
+        // a pbuffer config where there is one, else any config with desktop GL
+        for (EGLint surfaceType : {EGL_PBUFFER_BIT_, 0})
+        {
+            const EGLint configAttributes[] = {EGL_SURFACE_TYPE_, surfaceType, EGL_RENDERABLE_TYPE_, EGL_OPENGL_BIT_, EGL_RED_SIZE_, 8,
+                                               EGL_GREEN_SIZE_, 8, EGL_BLUE_SIZE_, 8, EGL_DEPTH_SIZE_, 24, EGL_NONE_};
+            if (chooseConfig(eglDisplay, configAttributes, &config, 1, &configCount) && configCount > 0)
+                break;
+        }
+    }
+    if (configCount > 0)
+    {
+        const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION_, 3, EGL_CONTEXT_MINOR_VERSION_, 3,
+                                            EGL_CONTEXT_OPENGL_PROFILE_MASK_, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_, EGL_NONE_};
+        eglContext = createContext(eglDisplay, config, nullptr, contextAttributes);
+    }
+    if (eglContext)
+    {
+        const char *displayExtensions = queryString(eglDisplay, EGL_EXTENSIONS_);
+        if (!displayExtensions || !std::strstr(displayExtensions, "EGL_KHR_surfaceless_context"))
+        {
+            const EGLint surfaceAttributes[] = {EGL_WIDTH_, 1, EGL_HEIGHT_, 1, EGL_NONE_};
+            eglSurface = createPbufferSurface(eglDisplay, config, surfaceAttributes);
+        }
+        if (!makeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+        {
+            symbol<EGLDestroyContextProc>("eglDestroyContext")(eglDisplay, eglContext);
+            eglContext = nullptr;
+        }
+    }
+    if (!eglContext)
+    {
+        if (eglSurface)
+            symbol<EGLDestroySurfaceProc>("eglDestroySurface")(eglDisplay, eglSurface);
+        if (eglDisplay)
+            terminate(eglDisplay);
+        eglSurface = nullptr;
+        eglDisplay = nullptr;
+        dlclose(library);
+        library = nullptr;
+        return false;
+    }
+
+    procAddress = getProcAddress;
+    backend = eglSurface ? "EGL pbuffer" : "EGL surfaceless";
+    return true;
+}
+
+bool HeadlessContext::createOSMesa()
+{
+    for (const char *name : {"libOSMesa.so.8", "libOSMesa.so.6", "libOSMesa.so"})
+    {
+        if ((library = dlopen(name, RTLD_NOW | RTLD_LOCAL)))
+            break;
+    }
+    if (!library)
+        return false;
+
+    auto createContext = symbol<OSMesaCreateContextAttribsProc>("OSMesaCreateContextAttribs");
+    auto makeCurrent = symbol<OSMesaMakeCurrentProc>("OSMesaMakeCurrent");
+    auto getProcAddress = symbol<OSMesaGetProcAddressProc>("OSMesaGetProcAddress");
+    if (createContext && makeCurrent && getProcAddress)
+    {
+        const int attributes[] = {OSMESA_FORMAT_, OSMESA_RGBA_, OSMESA_DEPTH_BITS_, 24, OSMESA_PROFILE_, OSMESA_CORE_PROFILE_,
+                                  OSMESA_CONTEXT_MAJOR_VERSION_, 3, OSMESA_CONTEXT_MINOR_VERSION_, 3, 0};
+        osMesaContext = createContext(attributes, nullptr);
+    }
+    osMesaBuffer.assign(4, 0);
+    if (osMesaContext && !makeCurrent(osMesaContext, osMesaBuffer.data(), GL_UNSIGNED_BYTE, 1, 1))
+    {
+        symbol<OSMesaDestroyContextProc>("OSMesaDestroyContext")(osMesaContext);
+        osMesaContext = nullptr;
+    }
+    if (!osMesaContext)
+    {
+        dlclose(library);
+        library = nullptr;
+        return false;
+    }
+
+    procAddress = getProcAddress;
+    backend = "OSMesa";
+    return true;
+}
+
+void HeadlessContext::Destroy()
+{
+    if (!library)
+        return;
+    if (eglContext)
+    {
+        symbol<EGLMakeCurrentProc>("eglMakeCurrent")(eglDisplay, nullptr, nullptr, nullptr);
+        if (eglSurface)
+            symbol<EGLDestroySurfaceProc>("eglDestroySurface")(eglDisplay, eglSurface);
+        symbol<EGLDestroyContextProc>("eglDestroyContext")(eglDisplay, eglContext);
+        symbol<EGLTerminateProc>("eglTerminate")(eglDisplay);
+    }
+    if (osMesaContext)
+        symbol<OSMesaDestroyContextProc>("OSMesaDestroyContext")(osMesaContext);
+
+    eglContext = eglSurface = eglDisplay = nullptr;
+    osMesaContext = nullptr;
+    procAddress = nullptr;
+    backend = "none";
+    dlclose(library);
+    library = nullptr;
+}
+
+void *HeadlessContext::GetProcAddress(const char *name)
+{
+    return procAddress ? procAddress(name) : nullptr;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <glad.h>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "StreamBuffer.h"
+
+// Layouts read by glMultiDrawArraysIndirect and glMultiDrawElementsIndirect
+struct DrawArraysIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+/**
+ * IndirectDrawBuffer holds the draw commands of a frame. RenderSystem fills
+ * them on the CPU, writes them into this frame's StreamBuffer region in one
+ * call, and submits every command of a program and VAO with a single
+ * glMultiDrawArraysIndirect or glMultiDrawElementsIndirect.
+ *
+ * The per-draw data is the InstanceBuffer: each command's baseInstance is the
+ * index of its first InstanceData, so the instance attributes of every draw
+ * are fetched at its draw's own index without any uniform set in between.
+ *
+ * Needs GL 4.3 or ARB_multi_draw_indirect, plus GL 4.2 or ARB_base_instance
+ * for baseInstance to be honoured; without them Supported() is false and
+ * RenderSystem draws instanced batches instead.
+ */
+class IndirectDrawBuffer
+{
+public:
+    IndirectDrawBuffer(StreamBuffer &streamBuffer) : streamBuffer(streamBuffer) {}
+
+    // Loads the multi-draw entry points when the driver has them. Needs a current context
+    bool Initialize(GLADloadproc getProcAddress);
+    bool Supported() const { return multiDrawArrays && multiDrawElements; }
+
+    void Clear();
+    // Appends a command and returns its index within its kind
+    size_t Add(const DrawArraysIndirectCommand &command);
+    size_t Add(const DrawElementsIndirectCommand &command);
+
+    const std::vector<DrawArraysIndirectCommand> &ArraysCommands() const { return arrays; }
+    const std::vector<DrawElementsIndirectCommand> &ElementsCommands() const { return elements; }
+    size_t Size() const { return arrays.size() + elements.size(); }
+    // Bytes Upload writes, for StreamBuffer::Reserve
+    size_t Bytes() const;
+
+    // Writes the commands into the stream buffer and binds it as the draw indirect buffer
+    void Upload();
+
+    // Draws count commands starting at first in one call. Only when Supported()
+    void MultiDrawArrays(size_t first, size_t count);
+    void MultiDrawElements(GLenum indexType, size_t first, size_t count);
+
+private:
+    typedef void(APIENTRYP MultiDrawArraysIndirectProc)(GLenum mode, const void *indirect, GLsizei drawcount, GLsizei stride);
+    typedef void(APIENTRYP MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount,
+                                                          GLsizei stride);
+    static constexpr GLenum DRAW_INDIRECT_BUFFER = 0x8F3F;
+
+    StreamBuffer &streamBuffer;
+    MultiDrawArraysIndirectProc multiDrawArrays = nullptr;
+    MultiDrawElementsIndirectProc multiDrawElements = nullptr;
+
+    std::vector<DrawArraysIndirectCommand> arrays;
+    std::vector<DrawElementsIndirectCommand> elements;
+    GLintptr arraysOffset = 0;
+    GLintptr elementsOffset = 0;
+};
+
+bool IndirectDrawBuffer::Initialize(GLADloadproc getProcAddress)
+{
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool multiDraw = major > 4 || (major == 4 && minor >= 3);
+    bool baseInstance = major > 4 || (major == 4 && minor >= 2);
+
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount && !(multiDraw && baseInstance); ++i)
+    {
+        const char *name = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (!name)
+            continue;
+        std::string extension(name);
+        multiDraw = multiDraw || extension == "GL_ARB_multi_draw_indirect";
+        baseInstance = baseInstance || extension == "GL_ARB_base_instance";
+    }
+    if (multiDraw && baseInstance)
+    {
+        multiDrawArrays = reinterpret_cast<MultiDrawArraysIndirectProc>(getProcAddress("glMultiDrawArraysIndirect"));
+        multiDrawElements = reinterpret_cast<MultiDrawElementsIndirectProc>(getProcAddress("glMultiDrawElementsIndirect"));
+    }
+
+    std::cout << "Multi-draw indirect " << (Supported() ? "enabled" : "unavailable, drawing instanced batches") << std::endl;
+    return Supported();
+}
+
+void IndirectDrawBuffer::Clear()
+{
+    arrays.clear();
+    elements.clear();
+}
+
+size_t IndirectDrawBuffer::Add(const DrawArraysIndirectCommand &command)
+{
+    arrays.push_back(command);
+    return arrays.size() - 1;
+}
+
+size_t IndirectDrawBuffer::Add(const DrawElementsIndirectCommand &command)
+{
+    elements.push_back(command);
+    return elements.size() - 1;
+}
+
+size_t IndirectDrawBuffer::Bytes() const
+{
+    return arrays.size() * sizeof(DrawArraysIndirectCommand) + elements.size() * sizeof(DrawElementsIndirectCommand) +
+           2 * StreamBuffer::ALIGNMENT;
+}
+
+void IndirectDrawBuffer::Upload()
+{
+    if (!Supported() || Size() == 0)
+        return;
+    arraysOffset = streamBuffer.Write(arrays.data(), arrays.size() * sizeof(DrawArraysIndirectCommand));
+    elementsOffset = streamBuffer.Write(elements.data(), elements.size() * sizeof(DrawElementsIndirectCommand));
+    glBindBuffer(DRAW_INDIRECT_BUFFER, streamBuffer.Buffer());
+}
+
+void IndirectDrawBuffer::MultiDrawArrays(size_t first, size_t count)
+{
+    const void *indirect = reinterpret_cast<const void *>(arraysOffset + first * sizeof(DrawArraysIndirectCommand));
+    multiDrawArrays(GL_TRIANGLES, indirect, static_cast<GLsizei>(count), sizeof(DrawArraysIndirectCommand));
+}
+
+void IndirectDrawBuffer::MultiDrawElements(GLenum indexType, size_t first, size_t count)
+{
+    const void *indirect = reinterpret_cast<const void *>(elementsOffset + first * sizeof(DrawElementsIndirectCommand));
+    multiDrawElements(GL_TRIANGLES, indexType, indirect, static_cast<GLsizei>(count), sizeof(DrawElementsIndirectCommand));
+}
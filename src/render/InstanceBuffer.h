@@ -0,0 +1,58 @@
+#pragma once
+#include <glad.h>
+#include <glm.hpp>
+#include <cstddef>
+#include <vector>
+#include "StreamBuffer.h"
+
+// Per-instance attributes read by the *Instanced.vert shaders
+struct InstanceData
+{
+    glm::mat4 model; // locations 2-5
+    glm::vec4 color; // location 6
+};
+
+constexpr GLuint INSTANCE_MODEL_LOCATION = 2;
+constexpr GLuint INSTANCE_COLOR_LOCATION = 6;
+
+/**
+ * InstanceBuffer holds the instance attributes of every instanced draw in a
+ * frame. RenderSystem writes them into this frame's StreamBuffer region in
+ * one call, then points the mesh VAO of each group at its range before
+ * glDrawArraysInstanced.
+ */
+class InstanceBuffer
+{
+public:
+    InstanceBuffer(StreamBuffer &streamBuffer) : streamBuffer(streamBuffer) {}
+
+    void Upload(const std::vector<InstanceData> &instances)
+    {
+        offset = streamBuffer.Write(instances.data(), instances.size() * sizeof(InstanceData));
+        buffer = streamBuffer.Buffer();
+    }
+
+    // Points the instance attributes of the bound VAO at instances starting at firstInstance
+    void BindAttributes(size_t firstInstance)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        const char *base = reinterpret_cast<const char *>(offset + firstInstance * sizeof(InstanceData));
+        for (GLuint column = 0; column < 4; ++column)
+        {
+            GLuint location = INSTANCE_MODEL_LOCATION + column;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                  base + offsetof(InstanceData, model) + column * sizeof(glm::vec4));
+            glVertexAttribDivisor(location, 1);
+            glEnableVertexAttribArray(location);
+        }
+        glVertexAttribPointer(INSTANCE_COLOR_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              base + offsetof(InstanceData, color));
+        glVertexAttribDivisor(INSTANCE_COLOR_LOCATION, 1);
+        glEnableVertexAttribArray(INSTANCE_COLOR_LOCATION);
+    }
+
+private:
+    StreamBuffer &streamBuffer;
+    GLuint buffer = 0;
+    GLintptr offset = 0;
+};
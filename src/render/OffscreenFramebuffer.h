@@ -0,0 +1,84 @@
+#pragma once
+#include <glad.h>
+#include <iostream>
+
+/**
+ * OffscreenFramebuffer is the render target of headless runs: an RGBA8
+ * colour and a 24 bit depth renderbuffer of a fixed size. Bind makes it both
+ * the draw and the read framebuffer, so frames are drawn into it and read
+ * back from it as from a window's default framebuffer.
+ */
+class OffscreenFramebuffer
+{
+public:
+    OffscreenFramebuffer() = default;
+    ~OffscreenFramebuffer() { Destroy(); }
+
+    OffscreenFramebuffer(const OffscreenFramebuffer &) = delete;
+    OffscreenFramebuffer &operator=(const OffscreenFramebuffer &) = delete;
+
+    // Needs a current context. Returns false if the framebuffer is incomplete
+    bool Create(int width, int height);
+    void Destroy();
+
+    // Binds the framebuffer and sets the viewport to cover it
+    void Bind() const;
+
+    GLuint Handle() const { return framebuffer; }
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+private:
+    GLuint framebuffer = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    int width = 0;
+    int height = 0;
+};
+
+bool OffscreenFramebuffer::Create(int framebufferWidth, int framebufferHeight)
+{
+    Destroy();
+    width = framebufferWidth;
+    height = framebufferHeight;
+
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Offscreen framebuffer incomplete: " << status << std::endl;
+        Destroy();
+        return false;
+    }
+    return true;
+}
+
+void OffscreenFramebuffer::Destroy()
+{
+    if (framebuffer)
+        glDeleteFramebuffers(1, &framebuffer);
+    if (color)
+        glDeleteRenderbuffers(1, &color);
+    if (depth)
+        glDeleteRenderbuffers(1, &depth);
+    framebuffer = color = depth = 0;
+}
+
+void OffscreenFramebuffer::Bind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+}
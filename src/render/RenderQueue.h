@@ -0,0 +1,171 @@
+#pragma once
+#include <glad.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "Entity.h"
+#include "IngestStats.h"
+
+enum RenderPass : uint8_t
+{
+    RENDER_PASS_SCENE = 0,
+    RENDER_PASS_OVERLAY = 1, // text and other screen overlays, drawn after the scene
+};
+
+// One draw emitted by RenderPreprocessorSystem for the current frame
+struct DrawItem
+{
+    uint64_t key;
+    Entity entity;
+    uint32_t programSlot;
+    GLuint VAO;
+    GLint firstVertex;
+    GLuint texture; // first texture bound by the entity, 0 if none
+    GLsizei vertexCount;
+    GLsizei indexCount; // drawn with glDrawElementsBaseVertex when set
+    GLenum indexType;
+    GLintptr indexOffset; // bytes into the index buffer bound to the VAO
+    bool transparent;
+};
+
+/**
+ * RenderQueue holds the draws of one frame. RenderPreprocessorSystem clears it
+ * and pushes a DrawItem per visible entity; RenderSystem sorts it by key and
+ * submits the items in order, skipping state that is already bound.
+ *
+ * Key layout, most significant bits first:
+ *
+ *   opaque        pass:2 | 0:1 | program:12 | texture:12 | mesh:16 | depth:21 (front to back)
+ *   transparent   pass:2 | 1:1 | depth:21 (back to front) | program:12 | texture:12 | mesh:16
+ *
+ * so opaque draws are grouped by state and transparent draws blend in depth
+ * order. Program slots, texture and VAO names wider than their fields only
+ * group less well; submission compares the real values. The mesh is the
+ * GeometryArena range, which entities sharing a cached mesh also share.
+ */
+class RenderQueue
+{
+public:
+    RenderQueue(IngestStats &stats) : stats(stats) {}
+
+    static constexpr float DEPTH_NEAR = 0.1f;
+    static constexpr float DEPTH_FAR = 100.0f;
+
+    static uint64_t MakeKey(RenderPass pass, bool transparent, uint32_t programSlot, GLuint texture, uint32_t mesh, float depth);
+
+    void Clear() { items.clear(); }
+    void Push(const DrawItem &item) { items.push_back(item); }
+
+    // Drops the items whose flag is 0, keeping the order of the rest
+    void Retain(const std::vector<uint8_t> &keep);
+    // Radix sorts the items by key
+    void Sort();
+
+    const std::vector<DrawItem> &Items() const { return items; }
+
+    // Records the draws and GL state changes of the frame just submitted, and
+    // the state changes the same draws cost when every draw bound everything
+    void RecordFrame(uint64_t draws, uint64_t stateChanges, uint64_t unsortedStateChanges);
+    // Records the instanced draws of the frame and the entities they covered
+    void RecordInstancing(uint64_t instancedDraws, uint64_t instances);
+    // Records the items of the frame that passed and failed the frustum test
+    void RecordCulling(uint64_t visible, uint64_t culled);
+    // Records the indexed draws of the frame, the vertices they submitted
+    // (the shading non-indexed drawing costs) and the unique vertices behind
+    // them (the shading with a perfect post-transform cache)
+    void RecordIndexing(uint64_t indexedDraws, uint64_t indices, uint64_t uniqueVertices);
+    // Records the multi-draw indirect calls of the frame and the commands
+    // built for them, one per run of the same mesh
+    void RecordIndirect(uint64_t multiDraws, uint64_t commands);
+
+private:
+    IngestStats &stats;
+    std::vector<DrawItem> items;
+    std::vector<DrawItem> scratch;
+};
+
+uint64_t RenderQueue::MakeKey(RenderPass pass, bool transparent, uint32_t programSlot, GLuint texture, uint32_t mesh, float depth)
+{
+    float normalized = std::clamp((depth - DEPTH_NEAR) / (DEPTH_FAR - DEPTH_NEAR), 0.0f, 1.0f);
+    uint64_t depthBits = static_cast<uint64_t>(normalized * 0x1FFFFF);
+
+    uint64_t key = static_cast<uint64_t>(pass & 0x3) << 62;
+    uint64_t state = (static_cast<uint64_t>(programSlot & 0xFFF) << 28) |
+                     (static_cast<uint64_t>(texture & 0xFFF) << 16) |
+                     static_cast<uint64_t>(mesh & 0xFFFF);
+    if (!transparent)
+        return key | (state << 21) | depthBits;
+
+    return key | (uint64_t(1) << 61) | ((0x1FFFFF - depthBits) << 40) | state;
+}
+
+void RenderQueue::Retain(const std::vector<uint8_t> &keep)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        if (keep[i])
+            items[kept++] = items[i];
+    }
+    items.resize(kept);
+}
+
+void RenderQueue::Sort()
+{
+    scratch.resize(items.size());
+
+    // least significant byte first; a byte every key shares needs no pass
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        std::array<size_t, 256> offsets{};
+        for (const DrawItem &item : items)
+            ++offsets[(item.key >> shift) & 0xFF];
+        if (std::any_of(offsets.begin(), offsets.end(), [&](size_t count)
+                        { return count == items.size(); }))
+            continue;
+
+        size_t total = 0;
+        for (size_t &offset : offsets)
+        {
+            size_t count = offset;
+            offset = total;
+            total += count;
+        }
+        for (const DrawItem &item : items)
+            scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+        items.swap(scratch);
+    }
+}
+
+void RenderQueue::RecordFrame(uint64_t draws, uint64_t stateChanges, uint64_t unsortedStateChanges)
+{
+    stats.lastFrameDrawCalls.store(draws, std::memory_order_relaxed);
+    stats.lastFrameStateChanges.store(stateChanges, std::memory_order_relaxed);
+    stats.lastFrameUnsortedStateChanges.store(unsortedStateChanges, std::memory_order_relaxed);
+}
+
+void RenderQueue::RecordInstancing(uint64_t instancedDraws, uint64_t instances)
+{
+    stats.lastFrameInstancedDraws.store(instancedDraws, std::memory_order_relaxed);
+    stats.lastFrameInstances.store(instances, std::memory_order_relaxed);
+}
+
+void RenderQueue::RecordCulling(uint64_t visible, uint64_t culled)
+{
+    stats.lastFrameVisible.store(visible, std::memory_order_relaxed);
+    stats.lastFrameCulled.store(culled, std::memory_order_relaxed);
+}
+
+void RenderQueue::RecordIndexing(uint64_t indexedDraws, uint64_t indices, uint64_t uniqueVertices)
+{
+    stats.lastFrameIndexedDraws.store(indexedDraws, std::memory_order_relaxed);
+    stats.lastFrameIndices.store(indices, std::memory_order_relaxed);
+    stats.lastFrameIndexedVertices.store(uniqueVertices, std::memory_order_relaxed);
+}
+
+void RenderQueue::RecordIndirect(uint64_t multiDraws, uint64_t commands)
+{
+    stats.lastFrameMultiDraws.store(multiDraws, std::memory_order_relaxed);
+    stats.lastFrameIndirectCommands.store(commands, std::memory_order_relaxed);
+}
@@ -1,4 +1,6 @@
 #include "ShaderManager.h"
+#include "SceneUniforms.h"
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -18,6 +20,7 @@ GLuint ShaderManager::CompileAndLinkShaders(const std::string& vertexCode, const
     GLuint fragmentShader = CompileShader(fragmentCode, GL_FRAGMENT_SHADER);
 
     GLuint programID = glCreateProgram();
+    markRetrievable(programID);
     glAttachShader(programID, vertexShader);
     glAttachShader(programID, fragmentShader);
     glLinkProgram(programID);
@@ -40,49 +43,417 @@ GLuint ShaderManager::CompileAndLinkShaders(const std::string& vertexCode, const
     return programID;
 }
 
-GLuint ShaderManager::LoadShaderProgram(const std::string& vertexPath, const std::string& fragmentPath) {
-    std::string vertexCode = ReadShaderFromFile(vertexPath);
-    std::string fragmentCode = ReadShaderFromFile(fragmentPath);
-    // Generate hash keys for both shaders
+uint32_t ShaderManager::InternPath(const std::string& path) {
+    auto it = internedPaths.find(path);
+    if (it != internedPaths.end()) {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(canonicalPaths.size());
+    internedPaths.emplace(path, id);
+
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    canonicalPaths.push_back(error ? path : canonical.string());
+    pathSources.emplace_back();
+    pathSourceLoaded.push_back(false);
+    return id;
+}
+
+const std::string& ShaderManager::pathSource(uint32_t pathId) {
+    if (!pathSourceLoaded[pathId]) {
+        pathSources[pathId] = ReadShaderFromFile(canonicalPaths[pathId]);
+        pathSourceLoaded[pathId] = true;
+    }
+    return pathSources[pathId];
+}
+
+std::string ShaderManager::sourceKey(const std::string& vertexCode, const std::string& fragmentCode) {
     std::hash<std::string> hasher;
-    std::string vertexHash = std::to_string(hasher(vertexCode));
-    std::string fragmentHash = std::to_string(hasher(fragmentCode));
-    std::string combinedHash = vertexHash + fragmentHash;
-    // Check if we already have a compiled program for this combination
+    return std::to_string(hasher(vertexCode)) + std::to_string(hasher(fragmentCode));
+}
+
+uint32_t ShaderManager::ResolveProgram(const std::string& vertexPath, const std::string& fragmentPath) {
+    uint32_t vertexId = InternPath(vertexPath);
+    uint32_t fragmentId = InternPath(fragmentPath);
+    uint64_t pathKey = (static_cast<uint64_t>(vertexId) << 32) | fragmentId;
+    auto cached = slotsByPaths.find(pathKey);
+    if (cached != slotsByPaths.end()) {
+        return cached->second;
+    }
+
+    const std::string& vertexCode = pathSource(vertexId);
+    const std::string& fragmentCode = pathSource(fragmentId);
+    // Same sources under different paths share the compiled program
+    std::string combinedHash = sourceKey(vertexCode, fragmentCode);
     auto it = shadersById.find(combinedHash);
-    if(it != shadersById.end()) {
-        // Program already compiled, return existing GLuint
-        return it->second;
+    GLuint programID;
+    if (it != shadersById.end()) {
+        programID = it->second;
+    } else {
+        programID = buildProgram(vertexCode, fragmentCode, true);
+        shadersById[combinedHash] = programID;
+    }
+    recordProgramPair(vertexPath, fragmentPath);
+
+    uint32_t slot = static_cast<uint32_t>(programSlots.size());
+    programSlots.push_back(ProgramSlot{vertexId, fragmentId, programID});
+    slotsByPaths[pathKey] = slot;
+    return slot;
+}
+
+uint32_t ShaderManager::InstancedVariant(uint32_t slot) {
+    if (programSlots[slot].instancedSlot != UNRESOLVED_SLOT) {
+        return programSlots[slot].instancedSlot;
+    }
+
+    std::string vertexPath = instancedPath(canonicalPaths[programSlots[slot].vertexPath]);
+    std::string fragmentPath = instancedPath(canonicalPaths[programSlots[slot].fragmentPath]);
+    uint32_t variant = 0;
+    std::error_code error;
+    if (std::filesystem::exists(vertexPath, error) && std::filesystem::exists(fragmentPath, error)) {
+        variant = ResolveProgram(vertexPath, fragmentPath);
+        // a variant that does not link falls back to drawing one entity at a time
+        GLint linked = GL_FALSE;
+        glGetProgramiv(Program(variant), GL_LINK_STATUS, &linked);
+        if (!linked) {
+            variant = 0;
+        }
+    }
+    // ResolveProgram may have grown programSlots
+    programSlots[slot].instancedSlot = variant;
+    return variant;
+}
+
+std::string ShaderManager::instancedPath(const std::string& path) {
+    std::filesystem::path variant(path);
+    return (variant.parent_path() / (variant.stem().string() + "Instanced" + variant.extension().string())).string();
+}
+
+GLuint ShaderManager::LoadShaderProgram(const std::string& vertexPath, const std::string& fragmentPath) {
+    return Program(ResolveProgram(vertexPath, fragmentPath));
+}
+
+size_t ShaderManager::ReloadShaderSource(const std::string& canonicalPath, const std::string& source) {
+    std::vector<bool> changed(canonicalPaths.size(), false);
+    bool any = false;
+    for (uint32_t id = 0; id < canonicalPaths.size(); ++id) {
+        if (canonicalPaths[id] == canonicalPath) {
+            pathSources[id] = source;
+            pathSourceLoaded[id] = true;
+            changed[id] = any = true;
+        }
+    }
+    if (!any) {
+        return 0;
+    }
+
+    size_t replaced = 0;
+    for (size_t slot = 1; slot < programSlots.size(); ++slot) {
+        ProgramSlot& entry = programSlots[slot];
+        if (!changed[entry.vertexPath] && !changed[entry.fragmentPath]) {
+            continue;
+        }
+
+        const std::string& vertexCode = pathSources[entry.vertexPath];
+        const std::string& fragmentCode = pathSources[entry.fragmentPath];
+        GLuint programID = buildProgram(vertexCode, fragmentCode, false);
+        if (programID == 0) {
+            std::cout << "Shader reload failed, keeping previous program: " << canonicalPath << std::endl;
+            continue;
+        }
+
+        GLuint previous = entry.program;
+        entry.program = programID;
+        shadersById[sourceKey(vertexCode, fragmentCode)] = programID;
+        ++replaced;
+
+        bool stillUsed = false;
+        for (const ProgramSlot& other : programSlots) {
+            stillUsed = stillUsed || other.program == previous;
+        }
+        if (!stillUsed && previous != 0) {
+            for (auto it = shadersById.begin(); it != shadersById.end();) {
+                it = it->second == previous ? shadersById.erase(it) : std::next(it);
+            }
+            compiledShaders.erase(previous);
+            uniformLocations.erase(previous);
+            objectLocations.erase(previous);
+            glDeleteProgram(previous);
+        }
+    }
+
+    if (replaced > 0) {
+        std::cout << "Reloaded shader " << canonicalPath << " (" << replaced << " programs)" << std::endl;
+    }
+    return replaced;
+}
+
+GLuint ShaderManager::tryBuildProgram(const std::string& vertexCode, const std::string& fragmentCode) {
+    GLint success;
+    GLuint vertexShader = CompileShader(vertexCode, GL_VERTEX_SHADER);
+    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+    GLuint fragmentShader = success ? CompileShader(fragmentCode, GL_FRAGMENT_SHADER) : 0;
+    if (fragmentShader) {
+        glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+    }
+    if (!success) {
+        glDeleteShader(vertexShader);
+        if (fragmentShader) {
+            glDeleteShader(fragmentShader);
+        }
+        return 0;
+    }
+
+    GLuint programID = glCreateProgram();
+    markRetrievable(programID);
+    glAttachShader(programID, vertexShader);
+    glAttachShader(programID, fragmentShader);
+    glLinkProgram(programID);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    glGetProgramiv(programID, GL_LINK_STATUS, &success);
+    if (!success) {
+        GLchar infoLog[512];
+        glGetProgramInfoLog(programID, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        glDeleteProgram(programID);
+        return 0;
+    }
+
+    compiledShaders[programID] = std::make_pair(vertexShader, fragmentShader);
+    return programID;
+}
+
+GLuint ShaderManager::buildProgram(const std::string& vertexCode, const std::string& fragmentCode, bool keepBroken) {
+    std::string key = sourceKey(vertexCode, fragmentCode);
+    GLuint programID = loadProgramBinary(key);
+    if (programID != 0) {
+        ++programsFromBinaryCache;
+        introspect(programID);
+        return programID;
+    }
+
+    programID = keepBroken ? CompileAndLinkShaders(vertexCode, fragmentCode) : tryBuildProgram(vertexCode, fragmentCode);
+    ++programsCompiled;
+    if (programID != 0) {
+        saveProgramBinary(key, programID);
+        introspect(programID);
     }
-    // No existing program, compile, link, and store as before
-    GLuint programID = CompileAndLinkShaders(vertexCode, fragmentCode);
-    shadersById[combinedHash] = programID;
     return programID;
 }
 
+// Records the location of every active uniform and binds the Scene block, once per linked program
+void ShaderManager::introspect(GLuint programID) {
+    auto& locations = uniformLocations[programID];
+    locations.clear();
+
+    GLint count = 0;
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &count);
+    GLchar name[256];
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(programID, i, sizeof(name), &length, &size, &type, name);
+        // members of uniform blocks have no location
+        GLint location = glGetUniformLocation(programID, name);
+        if (location < 0) {
+            continue;
+        }
+        std::string uniformName(name, length);
+        locations[uniformName] = location;
+        // arrays are reported as "name[0]" but set through their bare name
+        if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0) {
+            locations[uniformName.substr(0, uniformName.size() - 3)] = location;
+        }
+    }
+
+    ObjectUniformLocations& object = objectLocations[programID];
+    object.model = locations.count("model") ? locations["model"] : -1;
+    object.color = locations.count("ourColor") ? locations["ourColor"] : -1;
+
+    GLuint block = glGetUniformBlockIndex(programID, SCENE_UNIFORM_BLOCK_NAME);
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(programID, block, SCENE_UNIFORM_BINDING);
+    }
+}
+
+GLint ShaderManager::UniformLocation(GLuint programID, const std::string& name) const {
+    auto program = uniformLocations.find(programID);
+    if (program == uniformLocations.end()) {
+        // not built by this manager
+        return glGetUniformLocation(programID, name.c_str());
+    }
+    auto location = program->second.find(name);
+    return location != program->second.end() ? location->second : -1;
+}
+
+const ObjectUniformLocations& ShaderManager::ObjectLocations(GLuint programID) const {
+    static const ObjectUniformLocations none;
+    auto it = objectLocations.find(programID);
+    return it != objectLocations.end() ? it->second : none;
+}
+
+bool ShaderManager::EnableBinaryCache(GLADloadproc getProcAddress, const std::string& directory) {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool supported = major > 4 || (major == 4 && minor >= 1);
+
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount && !supported; ++i) {
+        const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        supported = name && std::string(name) == "GL_ARB_get_program_binary";
+    }
+
+    // some drivers expose the entry points but no formats to store
+    const GLenum numProgramBinaryFormats = 0x87FE;
+    GLint formats = 0;
+    if (supported) {
+        glGetIntegerv(numProgramBinaryFormats, &formats);
+    }
+
+    getProgramBinary = reinterpret_cast<GetProgramBinaryProc>(getProcAddress("glGetProgramBinary"));
+    programBinary = reinterpret_cast<ProgramBinaryProc>(getProcAddress("glProgramBinary"));
+    programParameteri = reinterpret_cast<ProgramParameteriProc>(getProcAddress("glProgramParameteri"));
+    binaryCacheEnabled = supported && formats > 0 && getProgramBinary && programBinary && programParameteri;
+
+    std::error_code error;
+    binaryCacheDirectory = directory;
+    std::filesystem::create_directories(directory, error);
+
+    auto glString = [](GLenum name) {
+        const GLubyte* value = glGetString(name);
+        return value ? std::string(reinterpret_cast<const char*>(value)) : std::string();
+    };
+    driverKey = glString(GL_VENDOR) + "|" + glString(GL_RENDERER) + "|" + glString(GL_VERSION);
+
+    std::cout << "Program binary cache " << (binaryCacheEnabled ? "enabled" : "unavailable") << " (" << driverKey << ")" << std::endl;
+    return binaryCacheEnabled;
+}
+
+void ShaderManager::markRetrievable(GLuint programID) {
+    const GLenum programBinaryRetrievableHint = 0x8257;
+    if (binaryCacheEnabled) {
+        programParameteri(programID, programBinaryRetrievableHint, GL_TRUE);
+    }
+}
+
+std::string ShaderManager::binaryPath(const std::string& sourceKey) const {
+    std::ostringstream name;
+    name << binaryCacheDirectory << "/" << std::hex << std::hash<std::string>()(sourceKey + driverKey) << ".bin";
+    return name.str();
+}
+
+GLuint ShaderManager::loadProgramBinary(const std::string& sourceKey) {
+    if (!binaryCacheEnabled) {
+        return 0;
+    }
+
+    std::ifstream file(binaryPath(sourceKey), std::ios::binary);
+    GLenum format = 0;
+    if (!file.read(reinterpret_cast<char*>(&format), sizeof(format))) {
+        return 0;
+    }
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    GLuint programID = glCreateProgram();
+    programBinary(programID, format, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint success = GL_FALSE;
+    glGetProgramiv(programID, GL_LINK_STATUS, &success);
+    if (!success) {
+        // stale binary, e.g. after a driver update; it is rewritten after compiling
+        glDeleteProgram(programID);
+        return 0;
+    }
+
+    compiledShaders[programID] = std::make_pair(0, 0);
+    return programID;
+}
+
+void ShaderManager::saveProgramBinary(const std::string& sourceKey, GLuint programID) {
+    const GLenum programBinaryLength = 0x8741;
+    GLint success = GL_FALSE;
+    glGetProgramiv(programID, GL_LINK_STATUS, &success);
+    if (!binaryCacheEnabled || !success) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(programID, programBinaryLength, &length);
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    getProgramBinary(programID, length, &length, &format, binary.data());
+
+    std::ofstream file(binaryPath(sourceKey), std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+    file.write(binary.data(), length);
+}
+
+void ShaderManager::recordProgramPair(const std::string& vertexPath, const std::string& fragmentPath) {
+    if (binaryCacheDirectory.empty()) {
+        return;
+    }
+    std::string pair = vertexPath + "\t" + fragmentPath;
+    std::ifstream existing(binaryCacheDirectory + "/programs.txt");
+    std::string line;
+    while (std::getline(existing, line)) {
+        if (line == pair) {
+            return;
+        }
+    }
+    std::ofstream(binaryCacheDirectory + "/programs.txt", std::ios::app) << pair << "\n";
+}
+
+size_t ShaderManager::WarmUp() {
+    std::ifstream list(binaryCacheDirectory + "/programs.txt");
+    std::vector<std::pair<std::string, std::string>> pairs;
+    std::string line;
+    while (std::getline(list, line)) {
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            pairs.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+        }
+    }
+
+    size_t resolved = 0;
+    for (auto& [vertexPath, fragmentPath] : pairs) {
+        std::error_code error;
+        if (std::filesystem::exists(vertexPath, error) && std::filesystem::exists(fragmentPath, error)) {
+            ResolveProgram(vertexPath, fragmentPath);
+            ++resolved;
+        }
+    }
+    return resolved;
+}
 
 void ShaderManager::UseShader(GLuint programID) {
     glUseProgram(programID);
 }
 
 void ShaderManager::SetUniform1i(GLuint programID, const std::string& name, int value) {
-    glUniform1i(glGetUniformLocation(programID, name.c_str()), value);
+    glUniform1i(UniformLocation(programID, name), value);
 }
 
 void ShaderManager::SetUniform1f(GLuint programID, const std::string& name, float value) {
-    glUniform1f(glGetUniformLocation(programID, name.c_str()), value);
+    glUniform1f(UniformLocation(programID, name), value);
 }
 
 void ShaderManager::SetUniform3f(GLuint programID, const std::string& name, float v1, float v2, float v3) {
-    glUniform3f(glGetUniformLocation(programID, name.c_str()), v1, v2, v3);
+    glUniform3f(UniformLocation(programID, name), v1, v2, v3);
 }
 
 void ShaderManager::SetUniform4fv(GLuint programID, const std::string &name, const glm::vec4 &value) {
-    glUniform4f(glGetUniformLocation(programID, name.c_str()), value[0], value[1], value[2], value[3]);
+    glUniform4f(UniformLocation(programID, name), value[0], value[1], value[2], value[3]);
 }
 
 void ShaderManager::SetUniformMatrix4fv(GLuint programID, const std::string& name, const GLfloat* value) {
-    glUniformMatrix4fv(glGetUniformLocation(programID, name.c_str()), 1, GL_FALSE, value);
+    glUniformMatrix4fv(UniformLocation(programID, name), 1, GL_FALSE, value);
 }
 
 GLuint ShaderManager::CompileShader(const std::string& source, GLenum type) {
@@ -1,5 +1,6 @@
 #pragma once
 #include <glad.h> // Include GLAD
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <glm.hpp>
@@ -7,21 +8,61 @@
 #include "GeometryComponent.h"
 #include "Vertex.h"
 
+// Locations of the per-object uniforms a program may declare; -1 if it does not
+struct ObjectUniformLocations
+{
+    GLint model = -1;
+    GLint color = -1; // ourColor
+};
+
 class ShaderManager
 {
 public:
     ShaderManager();
     ~ShaderManager();
 
-    // Load, compile, and link shaders from files
+    // Returns the program for a (vertex, fragment) path pair, reading and compiling
+    // the files only the first time the pair is seen
     GLuint LoadShaderProgram(const std::string &vertexPath, const std::string &fragmentPath);
 
+    // Returns the slot holding the program for a path pair; slots are never 0.
+    // The program in a slot is replaced when one of its sources is reloaded
+    uint32_t ResolveProgram(const std::string &vertexPath, const std::string &fragmentPath);
+    GLuint Program(uint32_t slot) const { return programSlots[slot].program; }
+
+    // Returns the slot of the instanced variant of the program in a slot, built from
+    // "<name>Instanced.<ext>" next to each of its sources, or 0 if it has none
+    uint32_t InstancedVariant(uint32_t slot);
+
+    // Maps a shader path to a small integer, so path pairs compare as one integer
+    uint32_t InternPath(const std::string &path);
+
+    // Rebuilds every program that uses the file, keeping the old program if the
+    // new source fails to compile or link. Returns the number of programs replaced
+    size_t ReloadShaderSource(const std::string &canonicalPath, const std::string &source);
+
+    // Enables the on-disk program binary cache when the driver supports program
+    // binaries (GL 4.1 or ARB_get_program_binary). Needs a current context
+    bool EnableBinaryCache(GLADloadproc getProcAddress, const std::string &directory = ".shadercache");
+
+    // Resolves every program pair recorded by earlier runs, so they are ready
+    // before the first frame. Returns the number of pairs resolved
+    size_t WarmUp();
+
+    size_t ProgramsCompiled() const { return programsCompiled; }
+    size_t ProgramsFromBinaryCache() const { return programsFromBinaryCache; }
+
     // Load, compile, and link shaders from files
     GLuint CompileAndLinkShaders(const std::string &vertexPath, const std::string &fragmentPath);
 
     // Use (activate) the shader program
     void UseShader(GLuint programID);
 
+    // Location of a uniform in a program, looked up in the table built when the
+    // program was linked instead of asking the driver; -1 if it is not active
+    GLint UniformLocation(GLuint programID, const std::string &name) const;
+    const ObjectUniformLocations &ObjectLocations(GLuint programID) const;
+
     // ShaderManager.h, corrected method signatures with programID
     void SetUniform1i(GLuint programID, const std::string &name, int value);
     void SetUniform1f(GLuint programID, const std::string &name, float value);
@@ -38,7 +79,56 @@ public:
 private:
     GLuint currentProgramID;                                               // Keep track of the current in-use shader program
     std::unordered_map<GLuint, std::pair<GLuint, GLuint>> compiledShaders; // Stores compiled shaders for cleanup
-    std::unordered_map<std::string, GLuint> shadersById;
+    std::unordered_map<std::string, GLuint> shadersById;                  // Programs by hash of their sources
+    std::unordered_map<GLuint, std::unordered_map<std::string, GLint>> uniformLocations; // Active uniforms per program
+    std::unordered_map<GLuint, ObjectUniformLocations> objectLocations;
+
+    struct ProgramSlot
+    {
+        uint32_t vertexPath;
+        uint32_t fragmentPath;
+        GLuint program;
+        uint32_t instancedSlot = UNRESOLVED_SLOT; // 0 once known to have no instanced variant
+    };
+    static constexpr uint32_t UNRESOLVED_SLOT = UINT32_MAX;
+
+    // interned paths, indexed by their id
+    std::unordered_map<std::string, uint32_t> internedPaths;
+    std::vector<std::string> canonicalPaths;
+    std::vector<std::string> pathSources;
+    std::vector<bool> pathSourceLoaded;
+
+    std::vector<ProgramSlot> programSlots{ProgramSlot{0, 0, 0}}; // slot 0 is "unresolved"
+    std::unordered_map<uint64_t, uint32_t> slotsByPaths;          // by interned (vertex, fragment) ids
+
+    // program binary cache, keyed by source hash and driver
+    typedef void(APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+    typedef void(APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+    typedef void(APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+    bool binaryCacheEnabled = false;
+    std::string binaryCacheDirectory;
+    std::string driverKey;
+    GetProgramBinaryProc getProgramBinary = nullptr;
+    ProgramBinaryProc programBinary = nullptr;
+    ProgramParameteriProc programParameteri = nullptr;
+    size_t programsCompiled = 0;
+    size_t programsFromBinaryCache = 0;
+
+    GLuint buildProgram(const std::string &vertexCode, const std::string &fragmentCode, bool keepBroken);
+    void introspect(GLuint programID);
+    void markRetrievable(GLuint programID);
+    std::string binaryPath(const std::string &sourceKey) const;
+    GLuint loadProgramBinary(const std::string &sourceKey);
+    void saveProgramBinary(const std::string &sourceKey, GLuint programID);
+    void recordProgramPair(const std::string &vertexPath, const std::string &fragmentPath);
+
+    const std::string &pathSource(uint32_t pathId);
+    static std::string sourceKey(const std::string &vertexCode, const std::string &fragmentCode);
+    static std::string instancedPath(const std::string &path);
+
+    // Compiles and links, returning 0 instead of a broken program on failure
+    GLuint tryBuildProgram(const std::string &vertexCode, const std::string &fragmentCode);
 
     // Methods to compile individual shaders
     GLuint CompileShader(const std::string &source, GLenum type);
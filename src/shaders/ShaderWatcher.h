@@ -0,0 +1,175 @@
+#pragma once
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ConcurrentQueue.h"
+
+struct ShaderSourceChange
+{
+    std::string path; // canonical path of the changed file
+    std::string source;
+};
+
+/**
+ * ShaderWatcher watches a shader directory tree with inotify and reads every
+ * file that is written or moved into place on its own thread. The render
+ * thread collects the new sources at a frame boundary with DrainChanges and
+ * hands them to ShaderManager::ReloadShaderSource, so a reload never waits on
+ * the disk inside a frame.
+ */
+class ShaderWatcher
+{
+public:
+    ShaderWatcher(std::string root = "shaders") : root(std::move(root)) {}
+    ~ShaderWatcher();
+
+    ShaderWatcher(const ShaderWatcher &) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+    // Starts watching; returns false if the directory cannot be watched
+    bool Start();
+
+    // Returns the changes read since the last call, latest source per path
+    std::vector<ShaderSourceChange> DrainChanges();
+
+private:
+    std::string root;
+    int inotifyFd = -1;
+    int stopFd = -1;
+    std::thread thread;
+    std::unordered_map<int, std::string> directories; // watch descriptor -> canonical directory
+    ConcurrentQueue<ShaderSourceChange> changes;
+
+    void run();
+    void watchDirectory(const std::string &directory);
+    void readChange(const std::string &path);
+};
+
+ShaderWatcher::~ShaderWatcher()
+{
+    if (thread.joinable())
+    {
+        uint64_t one = 1;
+        ssize_t written = write(stopFd, &one, sizeof(one));
+        (void)written;
+        thread.join();
+    }
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+    if (stopFd >= 0)
+        close(stopFd);
+}
+
+bool ShaderWatcher::Start()
+{
+    std::error_code error;
+    if (!std::filesystem::is_directory(root, error))
+        return false;
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotifyFd < 0 || stopFd < 0)
+    {
+        std::cerr << "Shader hot-reload disabled: inotify unavailable" << std::endl;
+        return false;
+    }
+
+    // inotify is not recursive, so every existing subdirectory gets its own watch
+    watchDirectory(std::filesystem::canonical(root, error).string());
+    for (auto &entry : std::filesystem::recursive_directory_iterator(root, error))
+    {
+        if (entry.is_directory())
+            watchDirectory(std::filesystem::canonical(entry.path(), error).string());
+    }
+
+    thread = std::thread(&ShaderWatcher::run, this);
+    return true;
+}
+
+void ShaderWatcher::watchDirectory(const std::string &directory)
+{
+    int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd >= 0)
+        directories[wd] = directory;
+}
+
+void ShaderWatcher::run()
+{
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents & POLLIN)
+            return;
+
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *cursor = buffer; cursor < buffer + length;)
+            {
+                auto *event = reinterpret_cast<inotify_event *>(cursor);
+                cursor += sizeof(inotify_event) + event->len;
+
+                auto directory = directories.find(event->wd);
+                if (directory == directories.end() || event->len == 0)
+                    continue;
+                std::string path = directory->second + "/" + event->name;
+
+                if (event->mask & IN_ISDIR)
+                {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                        watchDirectory(path);
+                }
+                else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                {
+                    readChange(path);
+                }
+            }
+        }
+    }
+}
+
+void ShaderWatcher::readChange(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+        return;
+    std::stringstream stream;
+    stream << file.rdbuf();
+    changes.Push(ShaderSourceChange{path, stream.str()});
+}
+
+std::vector<ShaderSourceChange> ShaderWatcher::DrainChanges()
+{
+    std::vector<ShaderSourceChange> drained;
+    ShaderSourceChange change;
+    while (changes.TryPop(change))
+    {
+        // editors often write a file several times per save; keep the last version
+        auto same = std::find_if(drained.begin(), drained.end(), [&](const ShaderSourceChange &other)
+                                 { return other.path == change.path; });
+        if (same != drained.end())
+            *same = std::move(change);
+        else
+            drained.push_back(std::move(change));
+    }
+    return drained;
+}
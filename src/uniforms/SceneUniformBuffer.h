@@ -0,0 +1,55 @@
+#pragma once
+#include <glad.h>
+#include <cstring>
+#include "SceneContext.h"
+#include "SceneUniforms.h"
+
+/**
+ * SceneUniformBuffer holds the camera and light uniforms in one uniform buffer
+ * bound at SCENE_UNIFORM_BINDING, so they are uploaded once per frame instead
+ * of being set on every draw.
+ */
+class SceneUniformBuffer
+{
+public:
+    ~SceneUniformBuffer()
+    {
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+    }
+
+    void Initialize()
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(SceneUniforms), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, SCENE_UNIFORM_BINDING, buffer);
+        uploaded = false;
+    }
+
+    // Uploads the scene uniforms if they changed since the last frame
+    void Update(SceneContext &sceneContext)
+    {
+        SceneUniforms next;
+        next.view = sceneContext.viewMatrix;
+        next.projection = sceneContext.getPerspectiveProjectionMatrix(sceneContext.windowWidth, sceneContext.windowHeight);
+        auto [lightPos, lightColor] = sceneContext.getLightProperties();
+        next.lightPos = glm::vec4(lightPos, 1.0f);
+        next.lightColor = glm::vec4(lightColor, 1.0f);
+
+        if (uploaded && std::memcmp(&next, &current, sizeof(SceneUniforms)) == 0)
+            return;
+
+        current = next;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SceneUniforms), &current);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        uploaded = true;
+    }
+
+private:
+    GLuint buffer = 0;
+    SceneUniforms current;
+    bool uploaded = false;
+};
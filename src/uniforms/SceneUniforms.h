@@ -0,0 +1,25 @@
+#pragma once
+#include <glad.h>
+#include <glm.hpp>
+
+// Uniform block shared by every program, matching this declaration in the shaders:
+//
+//   layout (std140) uniform Scene
+//   {
+//       mat4 view;
+//       mat4 projection;
+//       vec4 lightPos;   // xyz
+//       vec4 lightColor; // rgb
+//   };
+constexpr const char *SCENE_UNIFORM_BLOCK_NAME = "Scene";
+constexpr GLuint SCENE_UNIFORM_BINDING = 0;
+
+// std140 layout of the Scene block: mat4 and vec4 members need no padding
+struct SceneUniforms
+{
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    glm::vec4 lightPos{0.0f};
+    glm::vec4 lightColor{0.0f};
+};
+static_assert(sizeof(SceneUniforms) == 160, "SceneUniforms must match the std140 Scene block");
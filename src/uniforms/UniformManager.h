@@ -1,74 +1,133 @@
 #pragma once
-#include "UniformData.h"
 #include "Entity.h"
 #include "SceneContext.h"
 #include "ComponentManager.h"
+#include "EntityManager.h"
+#include "EventBus.h"
+#include <glad.h>
+#include <glm.hpp>
+#include <cstdint>
+#include <string>
 #include <unordered_map>
 #include <vector>
-#include <mutex>
 
+enum EntityUniformField : uint8_t
+{
+    UNIFORM_MODEL = 1 << 0,
+    UNIFORM_COLOR = 1 << 1,
+    UNIFORM_CUSTOM = 1 << 2, // entity has entries in the custom side table
+};
+
+// Per-object uniforms every program may use, stored in a fixed slot per entity
+struct EntityUniforms
+{
+    glm::mat4 model{1.0f};
+    glm::vec4 color{1.0f};
+    uint8_t fields = 0;
+
+    bool Has(EntityUniformField field) const { return (fields & field) != 0; }
+};
+
+// Any other per-entity uniform, set by name. The location is resolved against
+// the program it was last drawn with and reused until the program changes
+struct CustomUniform
+{
+    std::string name;
+    std::vector<int> values;
+    GLuint program = 0;
+    GLint location = -1;
+};
+
+/**
+ * UniformManager keeps the per-object uniforms of every entity in a dense
+ * array indexed by Entity, so the renderer reads them by reference without
+ * copying or hashing names. Uniforms other than model and color live in a
+ * small side table that only entities which need them pay for.
+ *
+ * Entries are cleared when EntityManager destroys the entity. Owned by the
+ * render thread.
+ */
 class UniformManager
 {
 public:
-    UniformManager(SceneContext &sceneContext, ComponentManager &componentManager);
-    void StoreEntityUniforms(Entity entity, std::string uniformName, std::vector<float> uniform);
-    void StoreEntityUniforms(Entity entity, std::string uniformName, std::vector<int> uniform);
-    void StoreEntityUniforms(Entity entity, std::string uniformName, int integer);
-    void StoreEntityUniforms(Entity entity, std::string uniformName, glm::mat4 matrix);
-    UniformData GetUniforms(Entity entity);
+    UniformManager(SceneContext &sceneContext, ComponentManager &componentManager, EventBus &eventBus);
+
+    void SetModel(Entity entity, const glm::mat4 &model);
+    void SetColor(Entity entity, const glm::vec4 &color);
+    void SetCustom(Entity entity, const std::string &name, std::vector<int> values);
+
+    const EntityUniforms &Get(Entity entity) const { return entityUniforms[entity]; }
+    // Custom uniforms of the entity, or nullptr; mutable so locations can be cached
+    std::vector<CustomUniform> *Custom(Entity entity);
+
+    void Remove(Entity entity);
+
     SceneContext GetSceneContext();
     void SetSceneContext(SceneContext &newSceneContext);
 
 private:
-    std::unordered_map<Entity, UniformData> entityUniformMap;
+    std::vector<EntityUniforms> entityUniforms;
+    std::unordered_map<Entity, std::vector<CustomUniform>> customUniforms;
     SceneContext &sceneContext;
     ComponentManager &componentManager;
-    std::mutex mutex;
 };
 
-UniformManager::UniformManager(SceneContext &sceneContext, ComponentManager &componentManager)
-    : componentManager(componentManager), sceneContext(sceneContext)
+UniformManager::UniformManager(SceneContext &sceneContext, ComponentManager &componentManager, EventBus &eventBus)
+    : entityUniforms(MAX_ENTITIES), componentManager(componentManager), sceneContext(sceneContext)
 {
+    eventBus.subscribe<EntityDestroyedEvent>([this](const EntityDestroyedEvent &event)
+                                             { this->Remove(event.entity); });
 }
 
-void UniformManager::StoreEntityUniforms(Entity entity, std::string uniformName, glm::mat4 matrix)
+void UniformManager::SetModel(Entity entity, const glm::mat4 &model)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    entityUniformMap[entity].mat4Uniforms[uniformName] = matrix;
+    EntityUniforms &uniforms = entityUniforms[entity];
+    uniforms.model = model;
+    uniforms.fields |= UNIFORM_MODEL;
 }
 
-void UniformManager::StoreEntityUniforms(Entity entity, std::string uniformName, int integer)
+void UniformManager::SetColor(Entity entity, const glm::vec4 &color)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    entityUniformMap[entity].intUniforms[uniformName] = std::vector<int>{integer};
+    EntityUniforms &uniforms = entityUniforms[entity];
+    uniforms.color = color;
+    uniforms.fields |= UNIFORM_COLOR;
 }
 
-void UniformManager::StoreEntityUniforms(Entity entity, std::string uniformName, std::vector<float> uniform)
+void UniformManager::SetCustom(Entity entity, const std::string &name, std::vector<int> values)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    entityUniformMap[entity].floatVecUniforms[uniformName] = uniform;
+    std::vector<CustomUniform> &custom = customUniforms[entity];
+    entityUniforms[entity].fields |= UNIFORM_CUSTOM;
+    for (CustomUniform &uniform : custom)
+    {
+        if (uniform.name == name)
+        {
+            uniform.values = std::move(values);
+            return;
+        }
+    }
+    custom.push_back(CustomUniform{name, std::move(values)});
 }
 
-void UniformManager::StoreEntityUniforms(Entity entity, std::string uniformName, std::vector<int> uniform)
+std::vector<CustomUniform> *UniformManager::Custom(Entity entity)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    entityUniformMap[entity].intUniforms[uniformName] = uniform;
+    if (!entityUniforms[entity].Has(UNIFORM_CUSTOM))
+        return nullptr;
+    return &customUniforms.at(entity);
 }
 
-UniformData UniformManager::GetUniforms(Entity entity)
+void UniformManager::Remove(Entity entity)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return entityUniformMap.at(entity);
+    if (entityUniforms[entity].Has(UNIFORM_CUSTOM))
+        customUniforms.erase(entity);
+    entityUniforms[entity] = EntityUniforms{};
 }
 
 SceneContext UniformManager::GetSceneContext()
 {
-    std::lock_guard<std::mutex> lock(mutex);
     return sceneContext;
 }
 
 void UniformManager::SetSceneContext(SceneContext &newSceneContext)
 {
-    std::lock_guard<std::mutex> lock(mutex);
     sceneContext = newSceneContext;
 }
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+/**
+ * BufferPool recycles the heap storage of std::vector buffers between the
+ * network threads that fill them and the render thread that drains them, so
+ * steady-state ingest of similarly sized meshes does not touch the allocator.
+ */
+template <typename T>
+class BufferPool
+{
+public:
+    BufferPool(std::size_t maxPooled = 64, std::size_t maxCapacity = 1 << 22)
+        : maxPooled(maxPooled), maxCapacity(maxCapacity) {}
+
+    // Returns an empty buffer, reusing pooled capacity when available
+    std::vector<T> Acquire(std::size_t reserve = 0)
+    {
+        std::vector<T> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!buffers.empty())
+            {
+                buffer = std::move(buffers.back());
+                buffers.pop_back();
+            }
+        }
+        if (buffer.capacity() < reserve)
+        {
+            buffer.reserve(reserve);
+        }
+        return buffer;
+    }
+
+    // Hands a buffer's storage back to the pool, dropping oversized buffers
+    void Release(std::vector<T> &&buffer)
+    {
+        if (buffer.capacity() == 0 || buffer.capacity() > maxCapacity)
+        {
+            return;
+        }
+        buffer.clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (buffers.size() < maxPooled)
+        {
+            buffers.push_back(std::move(buffer));
+        }
+    }
+
+    std::size_t Size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return buffers.size();
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::vector<T>> buffers;
+    std::size_t maxPooled;
+    std::size_t maxCapacity;
+};
@@ -34,13 +34,19 @@ public:
         queue.push(value);
         cv.notify_one();
     }
-    
+
+    void Push(T&& value) {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push(std::move(value));
+        cv.notify_one();
+    }
+
     bool TryPop(T& value) {
         std::lock_guard<std::mutex> lock(mtx);
         if (queue.empty()) {
             return false;
         }
-        value = queue.front();
+        value = std::move(queue.front());
         queue.pop();
         return true;
     }
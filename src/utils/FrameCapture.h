@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "IngestStats.h"
+#include "PngEncoder.h"
+
+/**
+ * FrameCapture hands rendered frames from the render thread to the server
+ * threads. FrameReadback submits the pixels of each frame it reads back; a
+ * worker thread encodes the newest one as PNG and publishes it, so neither
+ * encoding nor a slow client ever holds up a frame. Frames the worker had no
+ * time for are replaced by newer ones.
+ *
+ * Frames are only read back while someone wants them: while a stream is open,
+ * or for a second after a single frame was requested, and then at most
+ * MAX_FRAMES_PER_SECOND times a second.
+ */
+class FrameCapture
+{
+public:
+    struct Frame
+    {
+        uint64_t sequence = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> rgba; // top-down rows
+        std::string png;
+    };
+
+    static constexpr int64_t MAX_FRAMES_PER_SECOND = 60;
+    static constexpr int64_t REQUEST_LINGER_NANOSECONDS = 1000000000;
+
+    FrameCapture(IngestStats &stats);
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture &) = delete;
+    FrameCapture &operator=(const FrameCapture &) = delete;
+
+    // Render thread: true when a frame should be read back now
+    bool Wanted(int64_t now);
+    // Render thread: queues the pixels of a frame for encoding
+    void Submit(int width, int height, std::vector<unsigned char> &&rgba);
+
+    // Server threads: waits up to timeout for a frame newer than sequence and
+    // returns it, or the newest frame (null before the first) on timeout
+    std::shared_ptr<const Frame> WaitNewer(uint64_t sequence, std::chrono::milliseconds timeout);
+    // Server threads: the newest frame, without asking for a new one
+    std::shared_ptr<const Frame> Latest();
+
+    // Server threads: frames are read back continuously while a stream is open
+    void OpenStream();
+    void CloseStream();
+    // Server threads: true once the capture is shutting down and streams should end
+    bool Stopping();
+
+    // Keeps a stream open for its lifetime
+    class StreamScope
+    {
+    public:
+        StreamScope(FrameCapture &capture) : capture(capture) { capture.OpenStream(); }
+        ~StreamScope() { capture.CloseStream(); }
+
+        StreamScope(const StreamScope &) = delete;
+        StreamScope &operator=(const StreamScope &) = delete;
+
+    private:
+        FrameCapture &capture;
+    };
+
+private:
+    IngestStats &stats;
+    std::thread worker;
+
+    std::mutex mutex;
+    std::condition_variable submitted;
+    std::condition_variable published;
+    std::unique_ptr<Frame> pending; // raw frame waiting for the worker
+    std::shared_ptr<const Frame> latest;
+    uint64_t nextSequence = 1;
+    bool stopping = false;
+
+    std::atomic<int> streams{0};
+    std::atomic<int64_t> lastRequest{0};
+    int64_t lastReadback = 0; // render thread only
+
+    void workerLoop();
+};
+
+FrameCapture::FrameCapture(IngestStats &stats) : stats(stats)
+{
+    worker = std::thread(&FrameCapture::workerLoop, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    submitted.notify_all();
+    published.notify_all();
+    worker.join();
+}
+
+bool FrameCapture::Wanted(int64_t now)
+{
+    bool demand = streams.load(std::memory_order_relaxed) > 0 ||
+                  now - lastRequest.load(std::memory_order_relaxed) < REQUEST_LINGER_NANOSECONDS;
+    if (!demand || now - lastReadback < 1000000000 / MAX_FRAMES_PER_SECOND)
+        return false;
+    lastReadback = now;
+    return true;
+}
+
+void FrameCapture::Submit(int width, int height, std::vector<unsigned char> &&rgba)
+{
+    auto frame = std::make_unique<Frame>();
+    frame->width = width;
+    frame->height = height;
+    frame->rgba = std::move(rgba);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending)
+            stats.frameEncodeDrops.fetch_add(1, std::memory_order_relaxed);
+        frame->sequence = nextSequence++;
+        pending = std::move(frame);
+    }
+    submitted.notify_one();
+}
+
+void FrameCapture::workerLoop()
+{
+    while (true)
+    {
+        std::unique_ptr<Frame> frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            submitted.wait(lock, [this]
+                           { return stopping || pending; });
+            if (stopping)
+                return;
+            frame = std::move(pending);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        EncodePng(frame->width, frame->height, frame->rgba.data(), frame->png);
+        stats.frameEncode.Record(frame->png.size(), std::chrono::steady_clock::now() - start);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            latest = std::move(frame);
+        }
+        published.notify_all();
+    }
+}
+
+std::shared_ptr<const FrameCapture::Frame> FrameCapture::WaitNewer(uint64_t sequence, std::chrono::milliseconds timeout)
+{
+    lastRequest.store(IngestStats::NowNanoseconds(), std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(mutex);
+    published.wait_for(lock, timeout, [&]
+                       { return stopping || (latest && latest->sequence > sequence); });
+    return latest;
+}
+
+std::shared_ptr<const FrameCapture::Frame> FrameCapture::Latest()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return latest;
+}
+
+void FrameCapture::OpenStream()
+{
+    streams.fetch_add(1, std::memory_order_relaxed);
+    stats.frameStreams.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameCapture::CloseStream()
+{
+    streams.fetch_sub(1, std::memory_order_relaxed);
+    stats.frameStreams.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool FrameCapture::Stopping()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stopping;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <tuple>
+#include <vector>
+#include "QueueCollection.h"
+#include "MeshPipeline.h"
+
+/**
+ * IngestBatch accumulates decoded messages on a network thread and hands them
+ * to the QueueCollection as one queue entry per message type, so the queue
+ * mutex is taken once per batch instead of once per message.
+ */
+class IngestBatch
+{
+public:
+    IngestBatch(QueueCollection &queues, size_t maxBatchSize = 512)
+        : queues(queues), maxBatchSize(maxBatchSize) {}
+
+    ~IngestBatch() { Flush(); }
+
+    void Add(EntityCreationMessageV2 &&message);
+    void Add(EntityCreationMessage &&message);
+    void Add(EntityUpdateMessage &&message);
+    void Add(EntityDeletionMessage message);
+    void AddColor(float r, float g, float b);
+    void Flush();
+
+    QueueCollection &Queues() { return queues; }
+
+private:
+    QueueCollection &queues;
+    size_t maxBatchSize;
+
+    std::vector<EntityCreationMessageV2> creationsV2;
+    std::vector<EntityCreationMessage> creations;
+    std::vector<EntityUpdateMessage> updates;
+    std::vector<EntityDeletionMessage> deletions;
+    std::vector<std::tuple<float, float, float>> colors;
+
+    void flushIfFull(size_t size);
+    uint64_t nextSequence() { return queues.messageSequence.fetch_add(1, std::memory_order_relaxed); }
+};
+
+void IngestBatch::Add(EntityCreationMessageV2 &&message)
+{
+    message.sequence = nextSequence();
+    creationsV2.push_back(std::move(message));
+    flushIfFull(creationsV2.size());
+}
+
+void IngestBatch::Add(EntityCreationMessage &&message)
+{
+    creations.push_back(std::move(message));
+    flushIfFull(creations.size());
+}
+
+void IngestBatch::Add(EntityUpdateMessage &&message)
+{
+    message.sequence = nextSequence();
+    updates.push_back(std::move(message));
+    flushIfFull(updates.size());
+}
+
+void IngestBatch::Add(EntityDeletionMessage message)
+{
+    message.sequence = nextSequence();
+    deletions.push_back(message);
+    flushIfFull(deletions.size());
+}
+
+void IngestBatch::AddColor(float r, float g, float b)
+{
+    colors.emplace_back(r, g, b);
+    flushIfFull(colors.size());
+}
+
+void IngestBatch::flushIfFull(size_t size)
+{
+    if (size >= maxBatchSize)
+    {
+        Flush();
+    }
+}
+
+void IngestBatch::Flush()
+{
+    // creations go first and deletions last so a create, update and delete in
+    // the same batch apply in that order
+    if (!creations.empty())
+    {
+        queues.entityCreationQueue.Push(std::move(creations));
+        creations.clear();
+    }
+    queues.ingestStats.messagesIngested += creationsV2.size() + updates.size();
+    if (queues.meshPipeline && !(creationsV2.empty() && updates.empty() && deletions.empty()))
+    {
+        // deletions travel with the meshes so they cannot overtake them
+        MeshPipeline::Job job;
+        job.creations = std::move(creationsV2);
+        job.updates = std::move(updates);
+        job.deletions = std::move(deletions);
+        queues.meshPipeline->Submit(std::move(job));
+    }
+    if (!creationsV2.empty())
+    {
+        queues.entityCreationV2Queue.Push(std::move(creationsV2));
+    }
+    if (!updates.empty())
+    {
+        queues.entityUpdateQueue.Push(std::move(updates));
+    }
+    if (!deletions.empty())
+    {
+        queues.entityDeletionQueue.Push(std::move(deletions));
+    }
+    creationsV2.clear();
+    updates.clear();
+    deletions.clear();
+
+    for (auto &color : colors)
+    {
+        queues.colorQueue.Push(color);
+    }
+    colors.clear();
+}
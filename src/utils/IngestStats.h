@@ -0,0 +1,302 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <json.hpp>
+
+/**
+ * ThroughputCounter accumulates bytes processed and time spent by one stage
+ * of the ingest path.
+ */
+struct ThroughputCounter
+{
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> items{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> nanoseconds{0};
+
+    void Record(uint64_t byteCount, std::chrono::steady_clock::duration elapsed, uint64_t itemCount = 1)
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+        items.fetch_add(itemCount, std::memory_order_relaxed);
+        bytes.fetch_add(byteCount, std::memory_order_relaxed);
+        nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+    }
+
+    nlohmann::json ToJson() const
+    {
+        uint64_t totalCount = count.load();
+        uint64_t totalItems = items.load();
+        uint64_t totalBytes = bytes.load();
+        double seconds = nanoseconds.load() / 1e9;
+
+        nlohmann::json j;
+        j["count"] = totalCount;
+        j["items"] = totalItems;
+        j["bytes"] = totalBytes;
+        j["countPerSecond"] = seconds > 0 ? totalCount / seconds : 0.0;
+        j["itemsPerSecond"] = seconds > 0 ? totalItems / seconds : 0.0;
+        j["megabytesPerSecond"] = seconds > 0 ? (totalBytes / 1e6) / seconds : 0.0;
+        return j;
+    }
+};
+
+/**
+ * IngestStats collects counters shared between the network threads and the
+ * render thread. They are reported through the /stats endpoint so the cost of
+ * the ingest path can be measured on a running instance.
+ */
+struct IngestStats
+{
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    std::atomic<uint64_t> messagesIngested{0};
+    std::atomic<uint64_t> verticesIngested{0};
+    // bytes of vertex data copied between buffers after decoding
+    std::atomic<uint64_t> vertexBytesCopied{0};
+
+    ThroughputCounter jsonDecode;
+    ThroughputCounter binaryDecode;
+    // one count per /entities request, one item per entity in it
+    ThroughputCounter batchRequests;
+    // one count per server wakeup, one item per framed command
+    ThroughputCounter tcpIngest;
+    std::atomic<int64_t> tcpConnections{0};
+    // one count per websocket frame, one item per entity message in it
+    ThroughputCounter websocketIngest;
+    std::atomic<int64_t> websocketConnections{0};
+
+    // one count per MeshPipeline batch, one item per mesh interleaved off the render thread
+    ThroughputCounter meshPrepare;
+    // batches submitted to the MeshPipeline and not yet published
+    std::atomic<int64_t> meshPipelineBacklog{0};
+
+    // entity messages folded into another message for the same id before
+    // reaching the ECS, and creations cancelled by a deletion in the same frame
+    std::atomic<uint64_t> messagesCoalesced{0};
+    std::atomic<uint64_t> creationsCancelled{0};
+    std::atomic<uint64_t> lastFrameCoalesced{0};
+
+    // indexing: vertices merged by welding on ingest, and the bytes the welded
+    // vertices plus their indices save over repeating every vertex per triangle
+    std::atomic<uint64_t> verticesWelded{0};
+    std::atomic<uint64_t> indexedMeshes{0};
+    std::atomic<int64_t> indexingBytesSaved{0};
+
+    // vertex formats: meshes stored with compact positions, and the vertex
+    // bytes of every prepared mesh as stored and as plain floats
+    std::atomic<uint64_t> compactMeshes{0};
+    std::atomic<uint64_t> vertexFormatBytes{0};
+    std::atomic<uint64_t> vertexFormatFloatBytes{0};
+
+    // GeometryCache: meshes shared by content hash instead of stored per entity
+    std::atomic<uint64_t> geometryCacheHits{0};
+    std::atomic<uint64_t> geometryCacheMisses{0};
+    std::atomic<uint64_t> geometryBytesSaved{0};
+    std::atomic<uint64_t> geometryCacheEvictions{0};
+    std::atomic<uint64_t> geometryCacheCollisions{0}; // hash matches whose bytes differed
+    std::atomic<uint64_t> geometryCacheMeshes{0};
+    std::atomic<uint64_t> geometryCacheUnreferenced{0};
+    std::atomic<uint64_t> geometryCacheGpuBytes{0};
+
+    // GeometryArena: the shared vertex buffer all drawable meshes are sub-allocated from
+    std::atomic<uint64_t> geometryArenaCapacityBytes{0};
+    std::atomic<uint64_t> geometryArenaUsedBytes{0};
+    std::atomic<uint64_t> geometryArenaIndexCapacityBytes{0};
+    std::atomic<uint64_t> geometryArenaIndexUsedBytes{0};
+    std::atomic<uint64_t> geometryArenaRanges{0};
+    std::atomic<uint64_t> geometryArenaVertexFormats{0};
+    std::atomic<uint64_t> geometryArenaFreeBlocks{0};
+    std::atomic<uint64_t> geometryArenaLargestFreeBytes{0};
+    std::atomic<uint64_t> geometryArenaGrowths{0};
+    std::atomic<uint64_t> geometryArenaDefragmentations{0};
+
+    // StreamBuffer: per-frame ring regions for rebuilt geometry and instance data
+    std::atomic<uint64_t> streamBytes{0};
+    std::atomic<uint64_t> streamWaits{0}; // writes that blocked on a region still in flight
+    std::atomic<uint64_t> streamGrowths{0};
+    std::atomic<bool> streamPersistent{false};
+
+    // RenderQueue: draws and GL state changes (program, VAO, texture, blend) of
+    // the last frame, and what the same draws cost binding everything per draw
+    std::atomic<uint64_t> lastFrameDrawCalls{0};
+    std::atomic<uint64_t> lastFrameStateChanges{0};
+    std::atomic<uint64_t> lastFrameUnsortedStateChanges{0};
+    // glDrawArraysInstanced calls of the last frame and the entities they drew
+    std::atomic<uint64_t> lastFrameInstancedDraws{0};
+    std::atomic<uint64_t> lastFrameInstances{0};
+    // CullingSystem: queued draws inside and outside the view frustum last frame
+    std::atomic<uint64_t> lastFrameVisible{0};
+    std::atomic<uint64_t> lastFrameCulled{0};
+    // indexed draws last frame: indices submitted and the unique vertices they reference
+    std::atomic<uint64_t> lastFrameIndexedDraws{0};
+    std::atomic<uint64_t> lastFrameIndices{0};
+    std::atomic<uint64_t> lastFrameIndexedVertices{0};
+    // glMultiDraw*Indirect calls last frame and the indirect commands they covered
+    std::atomic<uint64_t> lastFrameMultiDraws{0};
+    std::atomic<uint64_t> lastFrameIndirectCommands{0};
+
+    // FrameReadback: frames read back through pixel buffer objects, readbacks
+    // skipped because every buffer was still in flight, and the time and frames
+    // from glReadPixels to the mapped pixels
+    std::atomic<uint64_t> framesReadBack{0};
+    std::atomic<uint64_t> frameReadbackDrops{0};
+    std::atomic<uint64_t> frameReadbackBytes{0};
+    std::atomic<uint64_t> frameReadbackNanoseconds{0};
+    std::atomic<uint64_t> lastFrameReadbackNanoseconds{0};
+    std::atomic<uint64_t> lastFrameReadbackFrames{0};
+    std::atomic<uint64_t> frameReadbacksLastSecond{0};
+    // FrameCapture: PNG encoding, frames replaced before the encoder reached
+    // them, frames sent by /frame and /frame/stream, and open streams
+    ThroughputCounter frameEncode;
+    std::atomic<uint64_t> frameEncodeDrops{0};
+    std::atomic<uint64_t> framesServed{0};
+    std::atomic<int64_t> frameStreams{0};
+
+    // steady clock time at which the render thread last drained the queues
+    std::atomic<int64_t> lastDrainNanoseconds{0};
+
+    static int64_t NowNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void MarkDrained()
+    {
+        lastDrainNanoseconds.store(NowNanoseconds(), std::memory_order_relaxed);
+    }
+
+    // How long data pushed at pushNanoseconds has waited for the render thread,
+    // or zero if the queues have been drained since
+    double LagMilliseconds(int64_t pushNanoseconds) const
+    {
+        if (lastDrainNanoseconds.load(std::memory_order_relaxed) >= pushNanoseconds)
+            return 0.0;
+        return (NowNanoseconds() - pushNanoseconds) / 1e6;
+    }
+
+    void RecordCopy(uint64_t bytes)
+    {
+        vertexBytesCopied.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // Records a welded mesh by its GPU size drawn non-indexed and as stored
+    void RecordIndexing(bool indexed, uint64_t welded, uint64_t nonIndexedBytes, uint64_t indexedBytes)
+    {
+        verticesWelded.fetch_add(welded, std::memory_order_relaxed);
+        if (indexed)
+            indexedMeshes.fetch_add(1, std::memory_order_relaxed);
+        indexingBytesSaved.fetch_add(static_cast<int64_t>(nonIndexedBytes) - static_cast<int64_t>(indexedBytes), std::memory_order_relaxed);
+    }
+
+    // Records the vertex bytes of a prepared mesh, as stored and as plain floats
+    void RecordVertexFormat(bool compact, uint64_t bytes, uint64_t floatBytes)
+    {
+        if (compact)
+            compactMeshes.fetch_add(1, std::memory_order_relaxed);
+        vertexFormatBytes.fetch_add(bytes, std::memory_order_relaxed);
+        vertexFormatFloatBytes.fetch_add(floatBytes, std::memory_order_relaxed);
+    }
+
+    nlohmann::json ToJson() const
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        uint64_t vertices = verticesIngested.load();
+        uint64_t copied = vertexBytesCopied.load();
+
+        nlohmann::json j;
+        j["uptimeSeconds"] = seconds;
+        j["messagesIngested"] = messagesIngested.load();
+        j["verticesIngested"] = vertices;
+        j["vertexBytesCopied"] = copied;
+        j["bytesCopiedPerVertex"] = vertices ? static_cast<double>(copied) / vertices : 0.0;
+        j["meshPrepare"] = meshPrepare.ToJson();
+        j["meshPipelineBacklog"] = meshPipelineBacklog.load();
+        j["messagesCoalesced"] = messagesCoalesced.load();
+        j["creationsCancelled"] = creationsCancelled.load();
+        j["lastFrameCoalesced"] = lastFrameCoalesced.load();
+        j["indexing"] = {
+            {"verticesWelded", verticesWelded.load()},
+            {"indexedMeshes", indexedMeshes.load()},
+            {"bytesSaved", indexingBytesSaved.load()},
+        };
+        uint64_t formatBytes = vertexFormatBytes.load();
+        uint64_t floatBytes = vertexFormatFloatBytes.load();
+        j["vertexFormat"] = {
+            {"compactMeshes", compactMeshes.load()},
+            {"vertexBytes", formatBytes},
+            {"floatVertexBytes", floatBytes},
+            {"ratio", floatBytes ? static_cast<double>(formatBytes) / floatBytes : 1.0},
+        };
+        uint64_t hits = geometryCacheHits.load();
+        uint64_t lookups = hits + geometryCacheMisses.load();
+        j["geometryCache"] = {
+            {"hits", hits},
+            {"misses", lookups - hits},
+            {"hitRate", lookups ? static_cast<double>(hits) / lookups : 0.0},
+            {"bytesSaved", geometryBytesSaved.load()},
+            {"evictions", geometryCacheEvictions.load()},
+            {"collisions", geometryCacheCollisions.load()},
+            {"meshes", geometryCacheMeshes.load()},
+            {"unreferencedMeshes", geometryCacheUnreferenced.load()},
+            {"gpuBytes", geometryCacheGpuBytes.load()},
+        };
+        uint64_t arenaCapacity = geometryArenaCapacityBytes.load();
+        uint64_t arenaFree = arenaCapacity - geometryArenaUsedBytes.load();
+        j["geometryArena"] = {
+            {"capacityBytes", arenaCapacity},
+            {"usedBytes", arenaCapacity - arenaFree},
+            {"indexCapacityBytes", geometryArenaIndexCapacityBytes.load()},
+            {"indexUsedBytes", geometryArenaIndexUsedBytes.load()},
+            {"ranges", geometryArenaRanges.load()},
+            {"vertexFormats", geometryArenaVertexFormats.load()},
+            {"freeBlocks", geometryArenaFreeBlocks.load()},
+            // share of the free space outside the largest free block
+            {"fragmentation", arenaFree ? 1.0 - static_cast<double>(geometryArenaLargestFreeBytes.load()) / arenaFree : 0.0},
+            {"growths", geometryArenaGrowths.load()},
+            {"defragmentations", geometryArenaDefragmentations.load()},
+        };
+        j["streaming"] = {
+            {"bytes", streamBytes.load()},
+            {"waits", streamWaits.load()},
+            {"growths", streamGrowths.load()},
+            {"persistent", streamPersistent.load()},
+        };
+        j["render"] = {
+            {"drawCalls", lastFrameDrawCalls.load()},
+            {"stateChanges", lastFrameStateChanges.load()},
+            {"unsortedStateChanges", lastFrameUnsortedStateChanges.load()},
+            {"instancedDraws", lastFrameInstancedDraws.load()},
+            {"instances", lastFrameInstances.load()},
+            {"visible", lastFrameVisible.load()},
+            {"culled", lastFrameCulled.load()},
+            {"indexedDraws", lastFrameIndexedDraws.load()},
+            {"indices", lastFrameIndices.load()},
+            {"indexedVertices", lastFrameIndexedVertices.load()},
+            {"multiDrawCalls", lastFrameMultiDraws.load()},
+            {"indirectCommands", lastFrameIndirectCommands.load()},
+        };
+        uint64_t readBack = framesReadBack.load();
+        j["frameCapture"] = {
+            {"framesReadBack", readBack},
+            {"readbackDrops", frameReadbackDrops.load()},
+            {"readbackBytes", frameReadbackBytes.load()},
+            {"readbacksPerSecond", frameReadbacksLastSecond.load()},
+            {"averageLatencyMilliseconds", readBack ? frameReadbackNanoseconds.load() / 1e6 / readBack : 0.0},
+            {"lastLatencyMilliseconds", lastFrameReadbackNanoseconds.load() / 1e6},
+            {"lastLatencyFrames", lastFrameReadbackFrames.load()},
+            {"encode", frameEncode.ToJson()},
+            {"encodeDrops", frameEncodeDrops.load()},
+            {"framesServed", framesServed.load()},
+            {"streams", frameStreams.load()},
+        };
+        j["jsonDecode"] = jsonDecode.ToJson();
+        j["binaryDecode"] = binaryDecode.ToJson();
+        j["batchRequests"] = batchRequests.ToJson();
+        j["tcpIngest"] = tcpIngest.ToJson();
+        j["tcpConnections"] = tcpConnections.load();
+        j["websocketIngest"] = websocketIngest.ToJson();
+        j["websocketConnections"] = websocketConnections.load();
+        return j;
+    }
+};
@@ -0,0 +1,181 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "QueueCollection.h"
+#include "PreparedMesh.h"
+
+/**
+ * MeshPipeline moves per-mesh preparation off the render thread. Batches
+ * flushed by IngestBatch are handed to a pool of worker threads that encode
+ * vertex data into each mesh's VertexFormat, weld identical vertices, compute
+ * bounds and hash the result for the GeometryCache; the finished batches are
+ * then published to the QueueCollection queues, so MessageSystem only moves
+ * ready buffers into components.
+ *
+ * Batches may finish out of order but are published in the order they were
+ * submitted, which keeps a create and a later delete for the same id from
+ * reaching the render thread swapped.
+ */
+class MeshPipeline
+{
+public:
+    struct Job
+    {
+        std::vector<EntityCreationMessageV2> creations;
+        std::vector<EntityUpdateMessage> updates;
+        std::vector<EntityDeletionMessage> deletions;
+    };
+
+    MeshPipeline(QueueCollection &queues, size_t workerCount = DefaultWorkerCount());
+    ~MeshPipeline();
+
+    MeshPipeline(const MeshPipeline &) = delete;
+    MeshPipeline &operator=(const MeshPipeline &) = delete;
+
+    void Submit(Job &&job);
+
+    static size_t DefaultWorkerCount()
+    {
+        return std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, 4);
+    }
+
+private:
+    QueueCollection &queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::pair<uint64_t, Job>> pending;
+    uint64_t nextTicket = 0;
+    bool stopping = false;
+
+    // finished jobs waiting for an earlier ticket to be published
+    std::mutex publishMutex;
+    std::map<uint64_t, Job> finished;
+    uint64_t nextPublish = 0;
+
+    void workerLoop();
+    void prepare(Job &job);
+    void prepareMesh(VertexData &vertexData, PreparedMesh &mesh);
+    void publish(uint64_t ticket, Job &&job);
+};
+
+MeshPipeline::MeshPipeline(QueueCollection &queues, size_t workerCount)
+    : queues(queues)
+{
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(&MeshPipeline::workerLoop, this);
+    }
+}
+
+MeshPipeline::~MeshPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void MeshPipeline::Submit(Job &&job)
+{
+    queues.ingestStats.meshPipelineBacklog.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.emplace_back(nextTicket++, std::move(job));
+    }
+    available.notify_one();
+}
+
+void MeshPipeline::workerLoop()
+{
+    while (true)
+    {
+        std::pair<uint64_t, Job> item;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this]
+                           { return stopping || !pending.empty(); });
+            // pending work is finished even when stopping
+            if (pending.empty())
+                return;
+            item = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        prepare(item.second);
+        publish(item.first, std::move(item.second));
+    }
+}
+
+void MeshPipeline::prepare(Job &job)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t meshes = 0;
+    uint64_t bytes = 0;
+
+    for (auto &message : job.creations)
+    {
+        prepareMesh(message.vertexData, message.mesh);
+        bytes += message.mesh.vertices.size();
+        ++meshes;
+    }
+    for (auto &message : job.updates)
+    {
+        if (message.Has(UPDATE_GEOMETRY))
+        {
+            prepareMesh(message.vertexData, message.mesh);
+            bytes += message.mesh.vertices.size();
+            ++meshes;
+        }
+    }
+
+    if (meshes > 0)
+    {
+        queues.ingestStats.meshPrepare.Record(bytes, std::chrono::steady_clock::now() - start, meshes);
+    }
+}
+
+// Interleaves one mesh and returns its decoded attribute buffers to the pool
+void MeshPipeline::prepareMesh(VertexData &vertexData, PreparedMesh &mesh)
+{
+    PrepareMesh(vertexData.positions, vertexData.texCoords, vertexData.normals, vertexData.colors, vertexData.indices,
+                vertexData.positionFormat, mesh);
+    queues.ingestStats.verticesIngested += mesh.vertexCount;
+    queues.ingestStats.RecordCopy(mesh.vertices.size());
+    queues.ingestStats.RecordIndexing(!mesh.indices.empty(), mesh.weldedVertices, mesh.NonIndexedBytes(), mesh.Bytes());
+    queues.ingestStats.RecordVertexFormat(VertexFormat::Get(mesh.format).IsCompact(), mesh.vertices.size(), mesh.FloatVertexBytes());
+
+    ReleaseVertexData(queues.floatBufferPool, vertexData);
+}
+
+void MeshPipeline::publish(uint64_t ticket, Job &&job)
+{
+    std::lock_guard<std::mutex> lock(publishMutex);
+    finished.emplace(ticket, std::move(job));
+
+    while (!finished.empty() && finished.begin()->first == nextPublish)
+    {
+        Job &ready = finished.begin()->second;
+        if (!ready.creations.empty())
+            queues.entityCreationV2Queue.Push(std::move(ready.creations));
+        if (!ready.updates.empty())
+            queues.entityUpdateQueue.Push(std::move(ready.updates));
+        if (!ready.deletions.empty())
+            queues.entityDeletionQueue.Push(std::move(ready.deletions));
+
+        finished.erase(finished.begin());
+        ++nextPublish;
+        queues.ingestStats.meshPipelineBacklog.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
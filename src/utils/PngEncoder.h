@@ -0,0 +1,113 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Encodes top-down RGBA8 pixels as a PNG into out. The image data is stored
+ * in uncompressed deflate blocks: encoding is a copy plus two checksums, fast
+ * enough to keep up with the render thread, at the cost of output as large
+ * as the pixels.
+ */
+inline void EncodePng(int width, int height, const unsigned char *rgba, std::string &out)
+{
+    static const std::array<uint32_t, 256> crcTable = []
+    {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    auto putU32 = [&out](uint32_t value)
+    {
+        out.push_back(static_cast<char>(value >> 24));
+        out.push_back(static_cast<char>(value >> 16));
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    };
+    // appends a chunk whose data is already at out[start + 8, end)
+    auto closeChunk = [&](size_t start)
+    {
+        uint32_t length = static_cast<uint32_t>(out.size() - start - 8);
+        for (int i = 0; i < 4; ++i)
+            out[start + i] = static_cast<char>(length >> (24 - 8 * i));
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = start + 4; i < out.size(); ++i)
+            crc = crcTable[(crc ^ static_cast<unsigned char>(out[i])) & 0xFF] ^ (crc >> 8);
+        putU32(crc ^ 0xFFFFFFFFu);
+    };
+    auto openChunk = [&](const char *type)
+    {
+        size_t start = out.size();
+        out.append(4, '\0');
+        out.append(type, 4);
+        return start;
+    };
+
+    size_t rowBytes = static_cast<size_t>(width) * 4;
+    size_t rawBytes = (rowBytes + 1) * height; // a filter byte before every row
+    size_t blocks = rawBytes / 65535 + 1;
+    out.clear();
+    out.reserve(8 + 25 + 12 + 2 + rawBytes + blocks * 5 + 4 + 12);
+    out.append("\x89PNG\r\n\x1a\n", 8);
+
+    size_t chunk = openChunk("IHDR");
+    putU32(static_cast<uint32_t>(width));
+    putU32(static_cast<uint32_t>(height));
+    out.append("\x08\x06\x00\x00\x00", 5); // 8 bit RGBA, deflate, no interlace
+    closeChunk(chunk);
+
+    chunk = openChunk("IDAT");
+    out.append("\x78\x01", 2); // zlib header, no compression
+    uint32_t adlerA = 1, adlerB = 0;
+    size_t blockLeft = 0;
+    size_t remaining = rawBytes;
+    auto put = [&](const unsigned char *data, size_t bytes)
+    {
+        while (bytes > 0)
+        {
+            if (blockLeft == 0)
+            {
+                blockLeft = remaining < 65535 ? remaining : 65535;
+                remaining -= blockLeft;
+                out.push_back(remaining == 0 ? 1 : 0); // final block flag
+                out.push_back(static_cast<char>(blockLeft));
+                out.push_back(static_cast<char>(blockLeft >> 8));
+                out.push_back(static_cast<char>(~blockLeft));
+                out.push_back(static_cast<char>(~blockLeft >> 8));
+            }
+            size_t step = bytes < blockLeft ? bytes : blockLeft;
+            out.append(reinterpret_cast<const char *>(data), step);
+            for (size_t i = 0; i < step; ++i)
+            {
+                adlerA += data[i];
+                if (adlerA >= 65521)
+                    adlerA -= 65521;
+                adlerB += adlerA;
+                if (adlerB >= 65521)
+                    adlerB -= 65521;
+            }
+            data += step;
+            bytes -= step;
+            blockLeft -= step;
+        }
+    };
+    const unsigned char noFilter = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        put(&noFilter, 1);
+        put(rgba + y * rowBytes, rowBytes);
+    }
+    putU32((adlerB << 16) | adlerA);
+    closeChunk(chunk);
+
+    chunk = openChunk("IEND");
+    closeChunk(chunk);
+}
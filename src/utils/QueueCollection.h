@@ -1,16 +1,38 @@
 #pragma once
+#include <atomic>
 #include <tuple>
 #include <vector>
 #include "ConcurrentQueue.h"
 #include "EntityCreationMessage.h"
 #include "EntityCreationMessageV2.h"
 #include "EntityDeletionMessage.h"
+#include "EntityUpdateMessage.h"
+#include "BufferPool.h"
+#include "IngestStats.h"
 #include <string>
 
+class MeshPipeline;
+class FrameCapture;
+
 struct QueueCollection {
     ConcurrentQueue<std::tuple<float, float, float>> colorQueue;
     ConcurrentQueue<std::tuple<float, float, float>> positionQueue;
     ConcurrentQueue<std::vector<EntityCreationMessage>> entityCreationQueue; // Queue for batch entity creation messages
     ConcurrentQueue<std::vector<EntityCreationMessageV2>> entityCreationV2Queue; // Queue for batch entity creation messages
+    ConcurrentQueue<std::vector<EntityUpdateMessage>> entityUpdateQueue; // Queue for batch partial entity updates
     ConcurrentQueue<std::vector<EntityDeletionMessage>> entityDeletionQueue; // Queue for batch entity deletion messages
+
+    // Ingest order of entity messages, so the render thread can fold the
+    // per-type queues back into the order producers sent them
+    std::atomic<uint64_t> messageSequence{0};
+
+    // When set, IngestBatch hands entity batches to the pipeline, which prepares
+    // their meshes on worker threads before pushing them onto the queues above
+    MeshPipeline *meshPipeline = nullptr;
+
+    // When set, the render thread reads frames back into it for /frame
+    FrameCapture *frameCapture = nullptr;
+
+    BufferPool<float> floatBufferPool; // Recycled storage for decoded vertex attribute arrays
+    IngestStats ingestStats;
 };
\ No newline at end of file